@@ -0,0 +1,327 @@
+// io_bench: compiles synthetic programs (bench/synth.hpp) and times `Tokenizer::tokenize`, `Parser::parse_prog`,
+// `lower_to_ir` and `Generator::gen_prog` on their own, then a whole `CompileSession::compile`. Prints one JSON object
+// per run (stdout or `--json=FILE`) and a table of medians on stderr.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "generation.hpp"
+#include "io.hpp"
+#include "ir.hpp"
+#include "metrics.hpp"
+#include "parser.hpp"
+#include "synth.hpp"
+#include "thread_pool.hpp"
+#include "tokenization.hpp"
+
+static void usage()
+{
+    std::cerr << "io_bench [options]" << std::endl;
+    std::cerr << "    --workload=W,...        lets, chain, graph, mixed or all (default: all)" << std::endl;
+    std::cerr << "    --size=S,...            program sizes in bytes, K, M or G (default: 1K,64K,1M,16M)" << std::endl;
+    std::cerr << "    --runs=N                runs per workload and size (default 3)" << std::endl;
+    std::cerr << "    --seed=N                generator seed (default 1)" << std::endl;
+    std::cerr << "    --chain=N               terms per `+` chain (default 256)" << std::endl;
+    std::cerr << "    --fan-in=N              variables each `let` of `graph` reads (default 4)" << std::endl;
+    std::cerr << "    --threads=N             threads per compile, as in `io --threads` (default 1)" << std::endl;
+    std::cerr << "    --json=FILE             write the per-run JSON to FILE instead of stdout" << std::endl;
+    std::cerr << "    --emit=FILE             write the program of the first workload and size to FILE and exit"
+              << std::endl;
+}
+
+// `123`, `64K`, `100M`, `1G`.
+static std::optional<size_t> parse_size(std::string_view text)
+{
+    size_t size = 0;
+    size_t i = 0;
+    for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; i++) {
+        size = size * 10 + static_cast<size_t>(text[i] - '0');
+    }
+    if (i == 0 || i + 1 < text.size()) {
+        return {};
+    }
+    if (i == text.size()) {
+        return size;
+    }
+    switch (text[i]) {
+    case 'K':
+    case 'k':
+        return size << 10;
+    case 'M':
+    case 'm':
+        return size << 20;
+    case 'G':
+    case 'g':
+        return size << 30;
+    default:
+        return {};
+    }
+}
+
+static std::vector<std::string_view> split_list(std::string_view text)
+{
+    std::vector<std::string_view> items;
+    while (!text.empty()) {
+        const size_t comma = text.find(',');
+        items.push_back(text.substr(0, comma));
+        text = comma == std::string_view::npos ? std::string_view() : text.substr(comma + 1);
+    }
+    return items;
+}
+
+struct BenchRun {
+    CompileMetrics phases; // each phase on its own, the optimizer skipped so the generator sees the whole program
+    CompileMetrics pipeline; // `CompileSession::compile` with the default options
+};
+
+static BenchRun run_once(std::string_view source, size_t threads)
+{
+    BenchRun run;
+    CompileMetrics& phases = run.phases;
+    phases.source_bytes = source.size();
+
+    // created outside the timed phases, unlike in `CompileSession`, so they measure the work itself
+    const size_t workers = threads == 0 ? ThreadPool::default_threads() : threads - 1;
+    std::optional<ThreadPool> pool;
+    if (workers > 0) {
+        pool.emplace(workers);
+    }
+
+    TokenStream tokens;
+    {
+        const PhaseTimer timer(&phases, "lex");
+        tokens = pool.has_value() ? Tokenizer(source).tokenize_parallel(pool.value()) : Tokenizer(source).tokenize();
+    }
+    phases.tokens = tokens.size();
+
+    Parser parser(std::move(tokens));
+    NodeProg prog;
+    {
+        const PhaseTimer timer(&phases, "parse");
+        prog = parser.parse_prog().value();
+    }
+    phases.ast_nodes = prog.node_count;
+    phases.statements = prog.stmts.size();
+    phases.arena_bytes = parser.arena().bytes_used();
+    phases.arena_high_water = parser.arena().high_water_mark();
+    phases.arena_reserved = parser.arena().bytes_reserved();
+
+    IrProg ir;
+    {
+        const PhaseTimer timer(&phases, "lower");
+        ir = lower_to_ir(prog);
+    }
+    phases.ir_instrs = ir.size();
+    {
+        const PhaseTimer timer(&phases, "codegen");
+        Generator generator(std::move(ir), CodegenMode::regs, CodegenTarget::executable);
+        phases.machine_instrs = (pool.has_value() ? generator.gen_prog(pool.value()) : generator.gen_prog()).size();
+    }
+
+    CompileOptions options;
+    options.collect_metrics = true;
+    options.threads = threads;
+    CompileResult result = CompileSession(options).compile(source);
+    if (!result.ok()) {
+        throw CompileError(result.diagnostics.front().message);
+    }
+    run.pipeline = std::move(result.metrics);
+    return run;
+}
+
+struct PhaseRate {
+    std::string name;
+    double wall_ms;
+    double cpu_ms;
+};
+
+// The separately timed phases, then the whole pipeline as `end-to-end`.
+static std::vector<PhaseRate> phase_rates(const BenchRun& run)
+{
+    std::vector<PhaseRate> rates;
+    for (const PhaseTime& phase : run.phases.phases) {
+        rates.push_back({ .name = phase.name, .wall_ms = phase.wall_ms, .cpu_ms = phase.cpu_ms });
+    }
+    const PhaseTime total = run.pipeline.total();
+    rates.push_back({ .name = "end-to-end", .wall_ms = total.wall_ms, .cpu_ms = total.cpu_ms });
+    return rates;
+}
+
+static double per_second(uint64_t count, double ms)
+{
+    return ms > 0 ? static_cast<double>(count) / (ms / 1e3) : 0.0;
+}
+
+static void write_run_json(std::ostream& out, Workload workload, const SynthOptions& synth, size_t threads,
+                           size_t run_index, const BenchRun& run)
+{
+    const CompileMetrics& m = run.phases;
+    out << std::fixed << std::setprecision(3);
+    out << "{\"workload\":\"" << workload_name(workload) << "\",\"target_bytes\":" << synth.bytes
+        << ",\"seed\":" << synth.seed << ",\"threads\":" << threads << ",\"run\":" << run_index
+        << ",\"bytes\":" << m.source_bytes << ",\"tokens\":" << m.tokens << ",\"nodes\":" << m.ast_nodes
+        << ",\"phases\":[";
+    bool first = true;
+    for (const PhaseRate& rate : phase_rates(run)) {
+        out << (first ? "" : ",") << "{\"name\":\"" << rate.name << "\",\"wall_ms\":" << rate.wall_ms
+            << ",\"cpu_ms\":" << rate.cpu_ms << ",\"bytes_per_s\":" << per_second(m.source_bytes, rate.wall_ms)
+            << ",\"tokens_per_s\":" << per_second(m.tokens, rate.wall_ms)
+            << ",\"nodes_per_s\":" << per_second(m.ast_nodes, rate.wall_ms) << "}";
+        first = false;
+    }
+    out << "],\"pipeline\":";
+    run.pipeline.write_json(out, workload_name(workload));
+    out << "}\n";
+    out.unsetf(std::ios::fixed);
+}
+
+// Median wall time of every phase over `runs`, with the throughputs it implies.
+static void print_summary(std::ostream& out, Workload workload, const std::vector<BenchRun>& runs)
+{
+    const CompileMetrics& m = runs.front().phases;
+    out << std::left << std::setw(7) << workload_name(workload) << std::right << std::setw(12) << m.source_bytes
+        << " bytes  " << std::setw(10) << m.tokens << " tokens  " << std::setw(10) << m.ast_nodes << " nodes\n";
+    const size_t phase_count = phase_rates(runs.front()).size();
+    for (size_t p = 0; p < phase_count; p++) {
+        std::vector<double> wall;
+        std::string name;
+        for (const BenchRun& run : runs) {
+            const PhaseRate rate = phase_rates(run)[p];
+            name = rate.name;
+            wall.push_back(rate.wall_ms);
+        }
+        std::sort(wall.begin(), wall.end());
+        const double ms = wall[wall.size() / 2];
+        out << "  " << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << ms << " ms" << std::setprecision(1) << std::setw(10)
+            << per_second(m.source_bytes, ms) / (1024.0 * 1024.0) << " MiB/s" << std::setw(10)
+            << per_second(m.tokens, ms) / 1e6 << " Mtok/s" << std::setw(10) << per_second(m.ast_nodes, ms) / 1e6
+            << " Mnode/s\n";
+        out.unsetf(std::ios::fixed);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<Workload> workloads;
+    std::vector<size_t> sizes;
+    size_t runs = 3;
+    size_t threads = 1;
+    SynthOptions synth;
+    std::optional<std::string> json_path;
+    std::optional<std::string> emit_path;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg.starts_with("--workload=")) {
+            for (const std::string_view name : split_list(arg.substr(11))) {
+                if (name == "all") {
+                    workloads.insert(
+                        workloads.end(), { Workload::lets, Workload::chain, Workload::graph, Workload::mixed });
+                }
+                else if (const std::optional<Workload> workload = parse_workload(name)) {
+                    workloads.push_back(workload.value());
+                }
+                else {
+                    std::cerr << "Unknown workload `" << name << "`" << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+        else if (arg.starts_with("--size=")) {
+            for (const std::string_view text : split_list(arg.substr(7))) {
+                const std::optional<size_t> size = parse_size(text);
+                if (!size.has_value()) {
+                    std::cerr << "Invalid size `" << text << "`" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                sizes.push_back(size.value());
+            }
+        }
+        else if (arg.starts_with("--runs=")) {
+            runs = std::max<size_t>(std::strtoul(argv[i] + 7, nullptr, 10), 1);
+        }
+        else if (arg.starts_with("--seed=")) {
+            synth.seed = std::strtoull(argv[i] + 7, nullptr, 10);
+        }
+        else if (arg.starts_with("--chain=")) {
+            synth.chain_length = std::max<size_t>(std::strtoul(argv[i] + 8, nullptr, 10), 1);
+        }
+        else if (arg.starts_with("--fan-in=")) {
+            synth.fan_in = std::max<size_t>(std::strtoul(argv[i] + 9, nullptr, 10), 1);
+        }
+        else if (arg.starts_with("--threads=")) {
+            threads = std::strtoul(argv[i] + 10, nullptr, 10);
+        }
+        else if (arg.starts_with("--json=")) {
+            json_path = std::string(arg.substr(7));
+        }
+        else if (arg.starts_with("--emit=")) {
+            emit_path = std::string(arg.substr(7));
+        }
+        else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (workloads.empty()) {
+        workloads = { Workload::lets, Workload::chain, Workload::graph, Workload::mixed };
+    }
+    if (sizes.empty()) {
+        sizes = { 1 << 10, 64 << 10, 1 << 20, 16 << 20 };
+    }
+
+    if (emit_path.has_value()) {
+        synth.workload = workloads.front();
+        synth.bytes = sizes.front();
+        std::ofstream file(emit_path.value(), std::ios::binary);
+        file << SynthProgram(synth).generate();
+        if (!file.flush()) {
+            std::cerr << "Failed to write `" << emit_path.value() << "`" << std::endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    std::ofstream json_file;
+    if (json_path.has_value()) {
+        json_file.open(json_path.value());
+        if (!json_file) {
+            std::cerr << "Failed to write `" << json_path.value() << "`" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    std::ostream& json = json_path.has_value() ? json_file : std::cout;
+
+    for (const Workload workload : workloads) {
+        for (const size_t size : sizes) {
+            synth.workload = workload;
+            synth.bytes = size;
+            const std::string source = SynthProgram(synth).generate();
+            std::vector<BenchRun> results;
+            for (size_t run = 0; run < runs; run++) {
+                try {
+                    results.push_back(run_once(source, threads));
+                }
+                catch (const std::exception& error) {
+                    std::cerr << workload_name(workload) << " " << size << ": " << error.what() << std::endl;
+                    return EXIT_FAILURE;
+                }
+                write_run_json(json, workload, synth, threads, run, results.back());
+            }
+            json.flush();
+            print_summary(std::cerr, workload, results);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+// Deterministic generator of synthetic `.io` programs for `io_bench`. The same workload, size and seed always produce
+// the same bytes, so runs on different machines and commits compare like for like.
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+enum class Workload : uint8_t {
+    lets, // many short independent `let`s
+    chain, // long `+` chains of literals
+    graph, // every `let` reads earlier ones: a deep variable reference graph
+    mixed, // all three interleaved
+};
+
+inline const char* workload_name(Workload workload)
+{
+    switch (workload) {
+    case Workload::lets:
+        return "lets";
+    case Workload::chain:
+        return "chain";
+    case Workload::graph:
+        return "graph";
+    case Workload::mixed:
+        return "mixed";
+    }
+    return "?";
+}
+
+inline std::optional<Workload> parse_workload(std::string_view name)
+{
+    for (const Workload workload : { Workload::lets, Workload::chain, Workload::graph, Workload::mixed }) {
+        if (name == workload_name(workload)) {
+            return workload;
+        }
+    }
+    return {};
+}
+
+struct SynthOptions {
+    Workload workload = Workload::mixed;
+    size_t bytes = 64 * 1024; // stop adding statements once the program is this long
+    uint64_t seed = 1;
+    size_t chain_length = 256; // terms per `+` chain
+    size_t fan_in = 4; // variables read per `let` in `graph`
+};
+
+/**
+ * A program of about `options.bytes` bytes (a little more: the statement that crosses the size and the final `exit`
+ * are always complete). Divisions are by non-zero literals only, so every program compiles and runs without a trap.
+ */
+class SynthProgram {
+public:
+    inline explicit SynthProgram(const SynthOptions& options)
+        : m_options(options)
+        , m_state(options.seed)
+    {
+    }
+
+    inline std::string generate()
+    {
+        m_out.clear();
+        m_out.reserve(m_options.bytes + 256);
+        m_lets = 0;
+        while (m_out.size() < m_options.bytes) {
+            Workload kind = m_options.workload;
+            if (kind == Workload::mixed) {
+                kind = static_cast<Workload>(next() % 3);
+            }
+            switch (kind) {
+            case Workload::lets:
+                let_literal();
+                break;
+            case Workload::chain:
+                let_chain();
+                break;
+            case Workload::graph:
+            case Workload::mixed:
+                let_graph();
+                break;
+            }
+        }
+        m_out += "exit(";
+        if (m_lets > 0) {
+            var(m_lets - 1);
+        }
+        else {
+            m_out += '0';
+        }
+        m_out += ");\n";
+        return std::move(m_out);
+    }
+
+private:
+    SynthOptions m_options;
+    uint64_t m_state;
+    std::string m_out;
+    size_t m_lets = 0;
+
+    // splitmix64
+    inline uint64_t next()
+    {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        return z ^ (z >> 31);
+    }
+
+    inline void number(uint64_t value)
+    {
+        char buffer[24];
+        const auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        m_out.append(buffer, end);
+    }
+
+    inline void var(size_t index)
+    {
+        m_out += 'v';
+        number(index);
+    }
+
+    inline void begin_let()
+    {
+        m_out += "let ";
+        var(m_lets++);
+        m_out += " = ";
+    }
+
+    inline void let_literal()
+    {
+        begin_let();
+        number(next() % 100000);
+        m_out += ";\n";
+    }
+
+    inline void let_chain()
+    {
+        begin_let();
+        number(next() % 1000);
+        for (size_t i = 1; i < m_options.chain_length; i++) {
+            m_out += " + ";
+            number(next() % 1000);
+        }
+        m_out += ";\n";
+    }
+
+    // Reads the previous `let` (so the graph is as deep as the program is long) plus random earlier ones.
+    inline void let_graph()
+    {
+        if (m_lets == 0) {
+            let_literal();
+            return;
+        }
+        const size_t self = m_lets;
+        begin_let();
+        var(self - 1);
+        static constexpr std::string_view OPS[] = { " + ", " - ", " * " };
+        for (size_t i = 1; i < m_options.fan_in; i++) {
+            const uint64_t r = next();
+            if (r % 8 == 0) {
+                m_out += " / ";
+                number(r % 7 + 1);
+                continue;
+            }
+            m_out += OPS[r % 3];
+            var(static_cast<size_t>(r >> 8) % self);
+        }
+        m_out += ";\n";
+    }
+};
@@ -0,0 +1,51 @@
+// Replacement global `operator new`/`delete` that count heap allocations per thread into `t_allocations`, for
+// `--time-passes`. Linked into the `io` driver only: libio itself never replaces a host's allocator.
+
+#include <cstdlib>
+#include <new>
+
+#include "metrics.hpp"
+
+[[maybe_unused]] static const bool installed = (g_allocation_hook = true);
+
+void* operator new(std::size_t size)
+{
+    t_allocations.count++;
+    t_allocations.bytes += size;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    t_allocations.count++;
+    t_allocations.bytes += size;
+    const auto alignment = static_cast<std::size_t>(align);
+    // aligned_alloc wants a multiple of the alignment
+    if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
@@ -11,25 +11,117 @@
 
 // Area of contiguous ropes of blocks
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <iostream>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+/**
+ * Chunked bump allocator. Starts with one chunk and, when it runs out, chains a new one twice the size of the last, so
+ * a program of any size fits without tuning a constant. Allocations are aligned for their type and constructed in
+ * place; nothing is ever destroyed individually, so only trivially destructible types may live here.
+ *
+ * `mark()`/`release()` rewind to an earlier point and `reset()` rewinds everything, keeping the chunks for reuse
+ * across compilations.
+ */
 class ArenaAllocator {
 public:
-    inline ArenaAllocator(size_t bytes)
-        : m_size(bytes)
+    struct Mark {
+        size_t chunk;
+        size_t offset;
+        size_t used;
+    };
+
+    inline explicit ArenaAllocator(size_t first_chunk_bytes = 64 * 1024)
+        : m_first_chunk_size(std::max<size_t>(first_chunk_bytes, 64))
+    {
+    }
+
+    // Raw, uninitialized memory.
+    inline void* allocate(size_t bytes, size_t align = alignof(std::max_align_t))
+    {
+        if (m_chunks.empty()) {
+            add_chunk(std::max(m_first_chunk_size, bytes + align));
+        }
+        for (;;) {
+            Chunk& chunk = m_chunks[m_current];
+            const auto base = reinterpret_cast<uintptr_t>(chunk.data);
+            const size_t aligned = ((base + m_offset + align - 1) & ~(uintptr_t)(align - 1)) - base;
+            if (aligned + bytes <= chunk.size) {
+                m_used += aligned + bytes - m_offset;
+                m_offset = aligned + bytes;
+                m_high_water = std::max(m_high_water, m_used);
+                return chunk.data + aligned;
+            }
+            next_chunk(bytes + align);
+        }
+    }
+
+    // automatically determine the size and alignment of the allocation, and construct it
+    template <typename T, typename... Args>
+    inline T* emplace(Args&&... args)
     {
-        m_buffer = static_cast<std::byte*>(malloc(m_size));
-        m_offset = m_buffer; // starts where buffer starts
+        static_assert(std::is_trivially_destructible_v<T>, "arena never runs destructors");
+        void* mem = allocate(sizeof(T), alignof(T));
+        return new (mem) T { std::forward<Args>(args)... };
     }
 
-    // automatically determine the size of allocation
+    // `count` value-initialized elements, contiguous
     template <typename T>
-    inline T* alloc()
+    inline T* alloc_array(size_t count)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "arena never runs destructors");
+        T* array = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+        for (size_t i = 0; i < count; i++) {
+            new (array + i) T {};
+        }
+        return array;
+    }
+
+    [[nodiscard]] inline Mark mark() const
+    {
+        return { .chunk = m_current, .offset = m_offset, .used = m_used };
+    }
+
+    // Everything allocated after `mark` is gone; the chunks stay around for reuse.
+    inline void release(const Mark& mark)
+    {
+        m_current = mark.chunk;
+        m_offset = mark.offset;
+        m_used = mark.used;
+    }
+
+    inline void reset()
+    {
+        release({ .chunk = 0, .offset = 0, .used = 0 });
+    }
+
+    // bytes handed out (including alignment padding) since construction or the last reset/release
+    [[nodiscard]] inline size_t bytes_used() const
+    {
+        return m_used;
+    }
+
+    // bytes obtained from malloc
+    [[nodiscard]] inline size_t bytes_reserved() const
     {
-        void* offset = m_offset; // starts where buffer starts
-        m_offset += sizeof(T);
-        return static_cast<T*>(offset);
+        return m_reserved;
+    }
+
+    [[nodiscard]] inline size_t chunk_count() const
+    {
+        return m_chunks.size();
+    }
+
+    // largest `bytes_used()` ever seen, across resets
+    [[nodiscard]] inline size_t high_water_mark() const
+    {
+        return m_high_water;
     }
 
     // make it non-copyable
@@ -37,13 +129,80 @@ public:
 
     inline ArenaAllocator operator=(const ArenaAllocator& other) = delete;
 
+    // Moving hands the chunks over; pointers into them stay valid.
+    inline ArenaAllocator(ArenaAllocator&& other) noexcept
+        : m_first_chunk_size(other.m_first_chunk_size)
+    {
+        swap(other);
+    }
+
+    inline ArenaAllocator& operator=(ArenaAllocator&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
     inline ~ArenaAllocator()
     {
-        free(m_buffer);
+        for (Chunk& chunk : m_chunks) {
+            free(chunk.data);
+        }
     };
 
 private:
-    size_t m_size;
-    std::byte* m_buffer;
-    std::byte* m_offset;
+    struct Chunk {
+        std::byte* data;
+        size_t size;
+    };
+
+    size_t m_first_chunk_size;
+    std::vector<Chunk> m_chunks;
+    size_t m_current = 0; // chunk we're bumping in
+    size_t m_offset = 0; // within the current chunk
+    size_t m_used = 0;
+    size_t m_reserved = 0;
+    size_t m_high_water = 0;
+
+    inline void swap(ArenaAllocator& other) noexcept
+    {
+        std::swap(m_first_chunk_size, other.m_first_chunk_size);
+        std::swap(m_chunks, other.m_chunks);
+        std::swap(m_current, other.m_current);
+        std::swap(m_offset, other.m_offset);
+        std::swap(m_used, other.m_used);
+        std::swap(m_reserved, other.m_reserved);
+        std::swap(m_high_water, other.m_high_water);
+    }
+
+    inline void add_chunk(size_t size)
+    {
+        auto* data = static_cast<std::byte*>(malloc(size));
+        if (data == nullptr) {
+            throw std::bad_alloc();
+        }
+        m_chunks.push_back({ .data = data, .size = size });
+        m_reserved += size;
+    }
+
+    // Move on to the chunk after the current one, reusing it if it's big enough.
+    inline void next_chunk(size_t min_size)
+    {
+        // bytes left in the current chunk are skipped, count them so `bytes_used` stays monotonic within a cycle
+        m_used += m_chunks[m_current].size - m_offset;
+        const size_t next = m_current + 1;
+        if (next < m_chunks.size() && m_chunks[next].size >= min_size) {
+            m_current = next;
+            m_offset = 0;
+            return;
+        }
+        // too small to reuse (or none): drop the tail and grow
+        for (size_t i = next; i < m_chunks.size(); i++) {
+            m_reserved -= m_chunks[i].size;
+            free(m_chunks[i].data);
+        }
+        m_chunks.resize(next);
+        add_chunk(std::max(m_chunks.back().size * 2, min_size));
+        m_current = next;
+        m_offset = 0;
+    }
 };
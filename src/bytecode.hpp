@@ -0,0 +1,263 @@
+#pragma once
+
+// Register bytecode for the interpreter (`vm.hpp`), lowered from the IR and serializable to disk so a program can be
+// run again without lexing or parsing it.
+//
+// Code is a stream of 32-bit words: an opcode word followed by its operands (see `BcOp`). All operands are register
+// numbers except the constant pool index of `imm`. Registers `0 .. slot_count-1` are the `let` slots; expression
+// temporaries come after them and are reused as soon as their value has been consumed, so a program needs only as
+// many registers as it has `let`s plus the deepest expression.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ir.hpp"
+#include "output.hpp"
+
+enum class BcOp : uint8_t {
+    imm, // dst, const: r[dst] = consts[const]
+    mov, // dst, src
+    add, // dst, a, b
+    sub, // dst, a, b
+    mul, // dst, a, b
+    div, // dst, a, b: traps on division by zero and INT64_MIN / -1
+    exit, // src: stop with r[src]
+    count,
+};
+
+// Words an instruction takes, opcode included.
+inline constexpr size_t bc_op_words(BcOp op)
+{
+    switch (op) {
+    case BcOp::imm:
+    case BcOp::mov:
+        return 3;
+    case BcOp::add:
+    case BcOp::sub:
+    case BcOp::mul:
+    case BcOp::div:
+        return 4;
+    case BcOp::exit:
+        return 2;
+    case BcOp::count:
+        break;
+    }
+    return 0;
+}
+
+struct Bytecode {
+    uint32_t reg_count = 0;
+    std::vector<int64_t> consts;
+    std::vector<uint32_t> code;
+
+    /**
+     * Check that the code can be run as is: every opcode is known, every instruction is complete, every register and
+     * constant index is in range, and the last instruction is an `exit` (there are no jumps, so execution can't run
+     * off the end). The interpreter relies on this and does no checks of its own.
+     *
+     * Every register is written by at least one instruction, so more registers than code words means a corrupt file.
+     */
+    [[nodiscard]] inline bool verify() const
+    {
+        if (reg_count > code.size()) {
+            return false;
+        }
+        size_t pc = 0;
+        BcOp last = BcOp::count;
+        while (pc < code.size()) {
+            if (code[pc] >= static_cast<uint32_t>(BcOp::count)) {
+                return false;
+            }
+            last = static_cast<BcOp>(code[pc]);
+            const size_t words = bc_op_words(last);
+            if (words > code.size() - pc) {
+                return false;
+            }
+            for (size_t k = 1; k < words; k++) {
+                const bool is_const = last == BcOp::imm && k == 2;
+                if (code[pc + k] >= (is_const ? consts.size() : reg_count)) {
+                    return false;
+                }
+            }
+            pc += words;
+        }
+        return last == BcOp::exit;
+    }
+};
+
+/**
+ * IR -> bytecode. `load`s emit nothing: a slot is written exactly once, before any read, so the value can be read from
+ * the slot register directly. A `store` retargets the instruction that computed its value when that was the last one
+ * emitted (`let x = a + b;` is a single `add`), and is a `mov` otherwise.
+ */
+class BytecodeLowering {
+public:
+    inline explicit BytecodeLowering(const IrProg& ir)
+        : m_ir(ir)
+    {
+    }
+
+    inline Bytecode lower()
+    {
+        m_bc.reg_count = m_ir.slot_count;
+        m_reg.assign(m_ir.size(), 0);
+        m_bc.code.reserve(m_ir.size() * 3);
+        for (size_t i = 0; i < m_ir.size(); i++) {
+            const IrArgs& arg = m_ir.args[i];
+            switch (m_ir.ops[i]) {
+            case IrOp::imm:
+                m_reg[i] = alloc_temp();
+                m_bc.consts.push_back(m_ir.imm_value(i));
+                emit(BcOp::imm, { m_reg[i], static_cast<uint32_t>(m_bc.consts.size() - 1) });
+                break;
+            case IrOp::load:
+                m_reg[i] = arg.a;
+                break;
+            case IrOp::store:
+                // a temporary was always computed by the instruction right before
+                if (is_temp(m_reg[arg.b]) && m_bc.code[m_last_dst] == m_reg[arg.b]) {
+                    m_bc.code[m_last_dst] = arg.a;
+                }
+                else {
+                    emit(BcOp::mov, { arg.a, m_reg[arg.b] });
+                }
+                release(m_reg[arg.b]);
+                break;
+            case IrOp::exit:
+                emit(BcOp::exit, { m_reg[arg.a] });
+                release(m_reg[arg.a]);
+                break;
+            default: {
+                const uint32_t lhs = m_reg[arg.a];
+                const uint32_t rhs = m_reg[arg.b];
+                release(lhs);
+                release(rhs);
+                m_reg[i] = alloc_temp();
+                emit(bc_op(m_ir.ops[i]), { m_reg[i], lhs, rhs });
+                break;
+            }
+            }
+        }
+        return std::move(m_bc);
+    }
+
+private:
+    const IrProg& m_ir;
+    Bytecode m_bc;
+    std::vector<uint32_t> m_reg; // register holding each IR value
+    std::vector<uint32_t> m_free_temps;
+    size_t m_last_dst = 0; // code index of the destination operand of the last instruction
+
+    static inline BcOp bc_op(IrOp op)
+    {
+        switch (op) {
+        case IrOp::sub:
+            return BcOp::sub;
+        case IrOp::mul:
+            return BcOp::mul;
+        case IrOp::div:
+            return BcOp::div;
+        default:
+            return BcOp::add;
+        }
+    }
+
+    [[nodiscard]] inline bool is_temp(uint32_t reg) const
+    {
+        return reg >= m_ir.slot_count;
+    }
+
+    inline uint32_t alloc_temp()
+    {
+        if (!m_free_temps.empty()) {
+            const uint32_t reg = m_free_temps.back();
+            m_free_temps.pop_back();
+            return reg;
+        }
+        return m_bc.reg_count++;
+    }
+
+    // Freed before the result is allocated, so `add t0, t0, t1` reuses an operand register.
+    inline void release(uint32_t reg)
+    {
+        if (is_temp(reg)) {
+            m_free_temps.push_back(reg);
+        }
+    }
+
+    inline void emit(BcOp op, std::initializer_list<uint32_t> operands)
+    {
+        m_last_dst = m_bc.code.size() + 1;
+        m_bc.code.push_back(static_cast<uint32_t>(op));
+        m_bc.code.insert(m_bc.code.end(), operands.begin(), operands.end());
+    }
+};
+
+inline Bytecode lower_to_bytecode(const IrProg& ir)
+{
+    return BytecodeLowering(ir).lower();
+}
+
+// On-disk format: this header, `const_count` int64s, then `code_words` uint32s, all little-endian.
+struct BytecodeHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t reg_count;
+    uint32_t const_count;
+    uint64_t code_words;
+};
+
+constexpr char BYTECODE_MAGIC[4] = { 'I', 'O', 'B', 'C' };
+constexpr uint32_t BYTECODE_VERSION = 1;
+
+inline bool write_bytecode(const std::string& path, const Bytecode& bc)
+{
+    BytecodeHeader header {};
+    std::memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+    header.version = BYTECODE_VERSION;
+    header.reg_count = bc.reg_count;
+    header.const_count = static_cast<uint32_t>(bc.consts.size());
+    header.code_words = bc.code.size();
+
+    OutputFile file(path);
+    file.write(&header, sizeof(header));
+    file.write(bc.consts.data(), bc.consts.size() * sizeof(int64_t));
+    file.write(bc.code.data(), bc.code.size() * sizeof(uint32_t));
+    return file.close();
+}
+
+// Parse and verify a serialized program; nothing if it is truncated, from another version, or fails `verify()`.
+inline std::optional<Bytecode> read_bytecode(std::string_view bytes)
+{
+    BytecodeHeader header {};
+    if (bytes.size() < sizeof(header)) {
+        return {};
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    bytes.remove_prefix(sizeof(header));
+    if (std::memcmp(header.magic, BYTECODE_MAGIC, sizeof(header.magic)) != 0 || header.version != BYTECODE_VERSION) {
+        return {};
+    }
+    const uint64_t const_bytes = static_cast<uint64_t>(header.const_count) * sizeof(int64_t);
+    if (header.code_words > bytes.size() / sizeof(uint32_t)
+        || bytes.size() != const_bytes + header.code_words * sizeof(uint32_t)) {
+        return {};
+    }
+
+    Bytecode bc;
+    bc.reg_count = header.reg_count;
+    bc.consts.resize(header.const_count);
+    bc.code.resize(header.code_words);
+    std::memcpy(bc.consts.data(), bytes.data(), const_bytes);
+    std::memcpy(bc.code.data(), bytes.data() + const_bytes, bc.code.size() * sizeof(uint32_t));
+    if (!bc.verify()) {
+        return {};
+    }
+    return bc;
+}
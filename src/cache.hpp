@@ -0,0 +1,339 @@
+#pragma once
+
+// Content-addressed cache of compiler outputs (`--cache`). An entry's key is the SHA-256 of the compiler identity, the
+// code-affecting options and the source, so a byte-identical rebuild with the same flags and the same `io` binary
+// skips lexing, parsing and codegen and just links (or copies) the finished artifacts into place.
+//
+// Layout: `<dir>/<first 2 hex digits>/<key><ext>`, one read-only file per artifact, plus `<dir>/stats` with the
+// persistent hit/miss counters. Writes go to `<dir>/tmp` first and are renamed into place, so a concurrent reader
+// sees a complete file or nothing. Eviction is LRU by mtime, which every hit refreshes.
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "sha256.hpp"
+
+enum class CacheArtifact : uint8_t {
+    executable,
+    assembly,
+    ir,
+    bytecode,
+};
+
+inline const char* cache_artifact_ext(CacheArtifact artifact)
+{
+    switch (artifact) {
+    case CacheArtifact::executable:
+        return ".exe";
+    case CacheArtifact::assembly:
+        return ".asm";
+    case CacheArtifact::ir:
+        return ".ir";
+    case CacheArtifact::bytecode:
+        return ".iobc";
+    }
+    return ".bin";
+}
+
+struct CacheStats {
+    uint64_t hits = 0; // persistent, all processes
+    uint64_t misses = 0;
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+};
+
+struct CachePruneResult {
+    uint64_t removed_entries = 0;
+    uint64_t removed_bytes = 0;
+    uint64_t remaining_bytes = 0;
+};
+
+class CompileCache {
+public:
+    inline explicit CompileCache(std::filesystem::path dir)
+        : m_dir(std::move(dir))
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(m_dir / "tmp", ec);
+        m_ok = !ec;
+    }
+
+    [[nodiscard]] inline bool ok() const
+    {
+        return m_ok;
+    }
+
+    [[nodiscard]] inline const std::filesystem::path& dir() const
+    {
+        return m_dir;
+    }
+
+    // Each part is length-prefixed, so no two different inputs hash the same bytes.
+    [[nodiscard]] static inline std::string key(std::string_view compiler_id, std::string_view options_key,
+                                                std::string_view source)
+    {
+        Sha256 hash;
+        for (const std::string_view part : { compiler_id, options_key, source }) {
+            const std::string len = std::to_string(part.size()) + ":";
+            hash.update(len);
+            hash.update(part);
+        }
+        return hash.hex_digest();
+    }
+
+    /**
+     * Place every `(artifact, destination)` of entry `key`: a hardlink when the cache and the destination share a file
+     * system, a copy otherwise. A hit only if all of them are in the cache. Each one is staged next to its destination
+     * and renamed over it only once all are staged, so a miss leaves the previous outputs as they were.
+     */
+    inline bool fetch(const std::string& key, const std::vector<std::pair<CacheArtifact, std::string>>& wanted)
+    {
+        std::error_code ec;
+        for (const auto& [artifact, destination] : wanted) {
+            if (!std::filesystem::is_regular_file(entry_path(key, artifact), ec)) {
+                m_misses.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        std::vector<std::string> staged;
+        for (const auto& [artifact, destination] : wanted) {
+            const std::filesystem::path entry = entry_path(key, artifact);
+            staged.push_back(destination + ".tmp." + std::to_string(getpid()) + "."
+                             + std::to_string(m_temp_counter.fetch_add(1)));
+            if (!stage(entry, staged.back())) {
+                // evicted since the check above
+                for (const std::string& path : staged) {
+                    std::filesystem::remove(path, ec);
+                }
+                m_misses.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            // most recently used
+            utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+        }
+        bool placed = true;
+        for (size_t i = 0; i < wanted.size(); i++) {
+            std::filesystem::rename(staged[i], wanted[i].second, ec);
+            if (ec) {
+                std::filesystem::remove(staged[i], ec);
+                placed = false;
+            }
+        }
+        (placed ? m_hits : m_misses).fetch_add(1, std::memory_order_relaxed);
+        return placed;
+    }
+
+    // Add an artifact that has been written to `path`. It is copied, so the output and the entry stay independent.
+    inline bool store(const std::string& key, CacheArtifact artifact, const std::string& path)
+    {
+        const std::string tmp = temp_path(key, artifact);
+        std::error_code ec;
+        if (!std::filesystem::copy_file(path, tmp, ec)) {
+            return false;
+        }
+        std::filesystem::permissions(
+            tmp,
+            artifact == CacheArtifact::executable ? std::filesystem::perms(0555) : std::filesystem::perms(0444),
+            ec);
+        return publish(tmp, key, artifact);
+    }
+
+    // Lookups by this process.
+    [[nodiscard]] inline uint64_t hits() const
+    {
+        return m_hits.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] inline uint64_t misses() const
+    {
+        return m_misses.load(std::memory_order_relaxed);
+    }
+
+    // Add this process's hits and misses to the persistent counters (under `flock`, other processes do the same).
+    inline bool flush_stats()
+    {
+        const uint64_t hits = m_hits.exchange(0);
+        const uint64_t misses = m_misses.exchange(0);
+        if (hits == 0 && misses == 0) {
+            return true;
+        }
+        return update_counters(hits, misses, nullptr);
+    }
+
+    [[nodiscard]] inline CacheStats stats()
+    {
+        CacheStats stats;
+        update_counters(0, 0, &stats);
+        for (const Entry& entry : scan()) {
+            stats.entries++;
+            stats.bytes += entry.bytes;
+        }
+        return stats;
+    }
+
+    // Evict least recently used entries (all artifacts of a key together) until at most `max_bytes` remain.
+    inline CachePruneResult prune(uint64_t max_bytes)
+    {
+        std::vector<Entry> entries = scan();
+        std::sort(entries.begin(), entries.end(),
+                  [](const Entry& a, const Entry& b) { return a.last_use < b.last_use; });
+        CachePruneResult result;
+        for (const Entry& entry : entries) {
+            result.remaining_bytes += entry.bytes;
+        }
+        for (const Entry& entry : entries) {
+            if (result.remaining_bytes <= max_bytes) {
+                break;
+            }
+            for (const std::filesystem::path& file : entry.files) {
+                std::error_code ec;
+                std::filesystem::remove(file, ec);
+            }
+            result.removed_entries++;
+            result.removed_bytes += entry.bytes;
+            result.remaining_bytes -= entry.bytes;
+        }
+        return result;
+    }
+
+private:
+    struct Entry {
+        std::vector<std::filesystem::path> files;
+        uint64_t bytes = 0;
+        // not `{}`: the file clock's epoch is in the future, so every real mtime is before it
+        std::filesystem::file_time_type last_use = std::filesystem::file_time_type::min();
+    };
+
+    std::filesystem::path m_dir;
+    bool m_ok = false;
+    std::atomic<uint64_t> m_hits = 0;
+    std::atomic<uint64_t> m_misses = 0;
+    std::atomic<uint64_t> m_temp_counter = 0;
+
+    [[nodiscard]] inline std::filesystem::path entry_path(const std::string& key, CacheArtifact artifact) const
+    {
+        return m_dir / key.substr(0, 2) / (key + cache_artifact_ext(artifact));
+    }
+
+    // unique per process and call, so concurrent writers never share a temp file
+    inline std::string temp_path(const std::string& key, CacheArtifact artifact)
+    {
+        return (m_dir / "tmp"
+                / (key + cache_artifact_ext(artifact) + "." + std::to_string(getpid()) + "."
+                   + std::to_string(m_temp_counter.fetch_add(1))))
+            .string();
+    }
+
+    // Link `entry` to `path`, or copy it there if it can't be linked; the copy must be writable, unlike the entry.
+    static inline bool stage(const std::filesystem::path& entry, const std::string& path)
+    {
+        std::error_code ec;
+        std::filesystem::create_hard_link(entry, path, ec);
+        if (!ec) {
+            return true;
+        }
+        ec.clear();
+        if (!std::filesystem::copy_file(entry, path, ec)) {
+            std::filesystem::remove(path, ec);
+            return false;
+        }
+        std::filesystem::permissions(path, std::filesystem::perms::owner_write, std::filesystem::perm_options::add, ec);
+        return true;
+    }
+
+    // rename() is atomic: readers see the old entry, the new one, or none, never a partial file
+    inline bool publish(const std::string& tmp, const std::string& key, CacheArtifact artifact)
+    {
+        const std::filesystem::path entry = entry_path(key, artifact);
+        std::error_code ec;
+        std::filesystem::create_directories(entry.parent_path(), ec);
+        std::filesystem::rename(tmp, entry, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    // Read the persistent counters (into `out`, if given) and add `hits`/`misses` to them, all under one lock.
+    inline bool update_counters(uint64_t hits, uint64_t misses, CacheStats* out)
+    {
+        const std::string path = (m_dir / "stats").string();
+        const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = flock(fd, LOCK_EX) == 0;
+        char text[128] = {};
+        const ssize_t n = ok ? pread(fd, text, sizeof(text) - 1, 0) : -1;
+        unsigned long long old_hits = 0;
+        unsigned long long old_misses = 0;
+        if (n > 0) {
+            std::sscanf(text, "hits %llu misses %llu", &old_hits, &old_misses);
+        }
+        if (out != nullptr) {
+            out->hits = old_hits;
+            out->misses = old_misses;
+        }
+        if (ok && (hits != 0 || misses != 0)) {
+            const std::string updated = "hits " + std::to_string(old_hits + hits) + "\nmisses "
+                + std::to_string(old_misses + misses) + "\n";
+            ok = ftruncate(fd, 0) == 0
+                && pwrite(fd, updated.data(), updated.size(), 0) == static_cast<ssize_t>(updated.size());
+        }
+        close(fd);
+        return ok;
+    }
+
+    // All entries, grouped by key; stale temp files of crashed writers are cleaned up on the way.
+    inline std::vector<Entry> scan()
+    {
+        std::unordered_map<std::string, Entry> by_key;
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(m_dir, ec);
+             !ec && it != std::filesystem::recursive_directory_iterator();
+             it.increment(ec)) {
+            if (!it->is_regular_file(ec)) {
+                continue;
+            }
+            const std::filesystem::path& path = it->path();
+            const auto mtime = it->last_write_time(ec);
+            if (path.parent_path().filename() == "tmp") {
+                if (std::filesystem::file_time_type::clock::now() - mtime > std::chrono::hours(1)) {
+                    std::filesystem::remove(path, ec);
+                }
+                continue;
+            }
+            if (path.parent_path() == m_dir) {
+                continue; // `stats`
+            }
+            const std::string name = path.filename().string();
+            Entry& entry = by_key[name.substr(0, name.find('.'))];
+            entry.files.push_back(path);
+            entry.bytes += it->file_size(ec);
+            entry.last_use = std::max(entry.last_use, mtime);
+        }
+        std::vector<Entry> entries;
+        entries.reserve(by_key.size());
+        for (auto& [key, entry] : by_key) {
+            entries.push_back(std::move(entry));
+        }
+        return entries;
+    }
+};
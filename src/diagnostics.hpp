@@ -0,0 +1,70 @@
+#pragma once
+
+// Errors in the program being compiled. The passes throw a `CompileError` at the point of failure (with the byte
+// offset it refers to, when there is one); `CompileSession` catches it and hands it back as a `Diagnostic`, so nothing
+// in the compiler prints or exits on its own.
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+class CompileError : public std::runtime_error {
+public:
+    static constexpr size_t NO_OFFSET = static_cast<size_t>(-1);
+
+    inline explicit CompileError(const std::string& message, size_t offset = NO_OFFSET)
+        : std::runtime_error(message)
+        , m_offset(offset)
+    {
+    }
+
+    // Byte offset into the source the error is about, or `NO_OFFSET`.
+    [[nodiscard]] inline size_t offset() const
+    {
+        return m_offset;
+    }
+
+private:
+    size_t m_offset;
+};
+
+struct Diagnostic {
+    enum class Severity : uint8_t { error, warning };
+
+    Severity severity = Severity::error;
+    std::string message;
+    size_t offset = CompileError::NO_OFFSET;
+    uint32_t line = 0; // 1-based; 0 when there is no location
+    uint32_t column = 0;
+
+    // Resolve `offset` to a line and column in `src`.
+    inline void locate(std::string_view src)
+    {
+        if (offset == CompileError::NO_OFFSET || offset > src.size()) {
+            return;
+        }
+        line = 1;
+        size_t line_start = 0;
+        for (size_t i = 0; i < offset; i++) {
+            if (src[i] == '\n') {
+                line++;
+                line_start = i + 1;
+            }
+        }
+        column = static_cast<uint32_t>(offset - line_start + 1);
+    }
+
+    // `file:line:column: error: message`, the format editors and build tools understand.
+    [[nodiscard]] inline std::string format(std::string_view file_name) const
+    {
+        std::string out(file_name);
+        if (line != 0) {
+            out += ":" + std::to_string(line) + ":" + std::to_string(column);
+        }
+        out += severity == Severity::error ? ": error: " : ": warning: ";
+        out += message;
+        return out;
+    }
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+// Minimal static ELF64 executable writer: one PT_LOAD segment holding the headers and the code, entry point right
+// after the headers. That's all a freestanding `_start` needs, so no assembler or linker is involved.
+
+#include <elf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "output.hpp"
+#include "x86_64.hpp"
+
+constexpr uint64_t ELF_BASE_ADDR = 0x400000;
+constexpr uint64_t ELF_HEADERS_SIZE = sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr);
+
+struct Elf64Headers {
+    Elf64_Ehdr ehdr;
+    Elf64_Phdr phdr;
+};
+static_assert(sizeof(Elf64Headers) == ELF_HEADERS_SIZE, "headers are written as one block");
+
+[[nodiscard]] inline Elf64Headers make_elf64_headers(uint64_t code_size)
+{
+    Elf64_Ehdr ehdr {};
+    std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = ET_EXEC;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_entry = ELF_BASE_ADDR + ELF_HEADERS_SIZE;
+    ehdr.e_phoff = sizeof(Elf64_Ehdr);
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    ehdr.e_phnum = 1;
+
+    Elf64_Phdr phdr {};
+    phdr.p_type = PT_LOAD;
+    phdr.p_flags = PF_R | PF_X;
+    phdr.p_offset = 0;
+    phdr.p_vaddr = ELF_BASE_ADDR;
+    phdr.p_paddr = ELF_BASE_ADDR;
+    phdr.p_filesz = ELF_HEADERS_SIZE + code_size;
+    phdr.p_memsz = phdr.p_filesz;
+    phdr.p_align = 0x1000;
+    return { ehdr, phdr };
+}
+
+[[nodiscard]] inline std::vector<uint8_t> make_elf64_executable(const std::vector<uint8_t>& code)
+{
+    const Elf64Headers headers = make_elf64_headers(code.size());
+    std::vector<uint8_t> image(ELF_HEADERS_SIZE + code.size());
+    std::memcpy(image.data(), &headers.ehdr, sizeof(headers.ehdr));
+    std::memcpy(image.data() + sizeof(headers.ehdr), &headers.phdr, sizeof(headers.phdr));
+    std::memcpy(image.data() + ELF_HEADERS_SIZE, code.data(), code.size());
+    return image;
+}
+
+/**
+ * Encode `instrs` and write them as an executable file at `path` (mode 0755). The code is encoded a chunk at a time
+ * and streamed out behind placeholder headers, which are patched once the code size is known, so the machine code is
+ * never held in memory as a whole. The size of the code goes to `code_bytes`, if given.
+ */
+inline bool write_elf64_executable(const std::string& path, const std::vector<Instr>& instrs,
+                                   uint64_t* code_bytes = nullptr)
+{
+    constexpr size_t CHUNK_BYTES = OutputFile::BUFFER_SIZE;
+
+    OutputFile file(path, 0755);
+    Elf64Headers headers = make_elf64_headers(0);
+    file.write(&headers, sizeof(headers));
+
+    Encoder encoder;
+    uint64_t code_size = 0;
+    for (const Instr& instr : instrs) {
+        encoder.encode(instr);
+        if (encoder.code().size() >= CHUNK_BYTES) {
+            file.write(encoder.code().data(), encoder.code().size());
+            code_size += encoder.code().size();
+            encoder.clear();
+        }
+    }
+    file.write(encoder.code().data(), encoder.code().size());
+    code_size += encoder.code().size();
+
+    if (code_bytes != nullptr) {
+        *code_bytes = code_size;
+    }
+    headers = make_elf64_headers(code_size);
+    file.patch(0, &headers, sizeof(headers));
+    return file.close();
+}
@@ -1,162 +1,797 @@
 #pragma once
 
-#include "parser.hpp" // NOTE: keep at top.
+#include "ir.hpp" // NOTE: keep at top.
 
-#include "sstream"
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <cstdlib>
-#include <sstream>
 #include <string>
-#include <unordered_map>
-#include <variant>
+#include <vector>
+
+#include "diagnostics.hpp"
+#include "metrics.hpp"
+#include "thread_pool.hpp"
+#include "x86_64.hpp"
+
+enum class CodegenMode {
+    stack, // every value goes through `push`/`pop`, the original stack machine
+    regs, // IR values live in registers, spilled to the frame only when they run out
+};
+
+enum class CodegenTarget {
+    executable, // `_start` of a static executable, `exit` is the exit syscall
+    jit, // a function called by the host (`--jit`), `exit` returns the status in rax
+};
+
+// How register codegen computes one IR instruction. `x` is the operand that stays in a register, `k` the constant.
+enum class Tile : uint8_t {
+    reg, // the generic form: `mov r, imm`, `mov r, [slot]`, `op r, r`
+    covered, // folded into the instruction that uses it, which emits it; gets no register
+    same, // x + 0, x - 0, x * 1, x / 1: the value is x
+    alu_imm, // add/sub/imul r, imm32
+    alu_mem, // add/sub/imul r, [slot]
+    inc, // x + 1, x - -1
+    dec, // x - 1, x + -1
+    neg, // 0 - x, x * -1
+    zero, // x * 0: x is still evaluated (it may divide by zero), then `xor`ed
+    shl, // x * 2^k
+    sar, // x / 2^k, rounded toward zero like `idiv`
+    lea_scale, // x * 3, 5 or 9: lea r, [r + r*(k - 1)]
+    lea_add, // x * 2, 4 or 8 + y: lea r, [y + x*k]
+    store_imm, // mov [slot], imm32
+    exit_imm, // exit(imm)
+};
+
+// What a tiling rule wants one operand of the instruction to be.
+enum class TileShape : uint8_t {
+    imm, // an `imm` whose value the rule accepts
+    load, // a `load`, which becomes a memory operand
+    scaled, // a `mul` tiled as `shl` by 1, 2 or 3; the rule sees the factor
+};
+
+// Which operand: `a` (lhs, `exit`'s status), `b` (rhs, `store`'s value) or either, rhs first.
+enum class TileSide : uint8_t { lhs, rhs, either };
+
+// Which constants a rule takes (for `TileShape::load` the slot, which any rule takes).
+enum class TileConst : uint8_t {
+    any,
+    zero,
+    one,
+    minus_one,
+    imm32, // fits a sign-extended 32-bit immediate
+    pow2, // 2^k, k >= 1
+    lea_factor, // 3, 5, 9
+    lea_scale, // 2, 4, 8
+};
+
+inline bool tile_const_matches(TileConst accepts, int64_t k)
+{
+    switch (accepts) {
+    case TileConst::any:
+        return true;
+    case TileConst::zero:
+        return k == 0;
+    case TileConst::one:
+        return k == 1;
+    case TileConst::minus_one:
+        return k == -1;
+    case TileConst::imm32:
+        return k >= INT32_MIN && k <= INT32_MAX;
+    case TileConst::pow2:
+        return k > 1 && (k & (k - 1)) == 0;
+    case TileConst::lea_factor:
+        return k == 3 || k == 5 || k == 9;
+    case TileConst::lea_scale:
+        return k == 2 || k == 4 || k == 8;
+    }
+    return false;
+}
+
+struct TileRule {
+    IrOp op;
+    TileShape shape;
+    TileSide side;
+    TileConst accepts;
+    Tile tile;
+};
+
+// The tiling table: the first rule that matches an instruction picks its tile, so for each operation the shorter tiles
+// come first. Anything no rule matches is `Tile::reg`.
+inline constexpr TileRule TILE_RULES[] = {
+    { IrOp::add, TileShape::imm, TileSide::either, TileConst::zero, Tile::same },
+    { IrOp::add, TileShape::imm, TileSide::either, TileConst::one, Tile::inc },
+    { IrOp::add, TileShape::imm, TileSide::either, TileConst::minus_one, Tile::dec },
+    { IrOp::add, TileShape::imm, TileSide::either, TileConst::imm32, Tile::alu_imm },
+    { IrOp::add, TileShape::scaled, TileSide::either, TileConst::lea_scale, Tile::lea_add },
+    { IrOp::add, TileShape::load, TileSide::either, TileConst::any, Tile::alu_mem },
+    { IrOp::sub, TileShape::imm, TileSide::rhs, TileConst::zero, Tile::same },
+    { IrOp::sub, TileShape::imm, TileSide::rhs, TileConst::one, Tile::dec },
+    { IrOp::sub, TileShape::imm, TileSide::rhs, TileConst::minus_one, Tile::inc },
+    { IrOp::sub, TileShape::imm, TileSide::rhs, TileConst::imm32, Tile::alu_imm },
+    { IrOp::sub, TileShape::imm, TileSide::lhs, TileConst::zero, Tile::neg },
+    { IrOp::sub, TileShape::load, TileSide::rhs, TileConst::any, Tile::alu_mem },
+    { IrOp::mul, TileShape::imm, TileSide::either, TileConst::zero, Tile::zero },
+    { IrOp::mul, TileShape::imm, TileSide::either, TileConst::one, Tile::same },
+    { IrOp::mul, TileShape::imm, TileSide::either, TileConst::minus_one, Tile::neg },
+    { IrOp::mul, TileShape::imm, TileSide::either, TileConst::pow2, Tile::shl },
+    { IrOp::mul, TileShape::imm, TileSide::either, TileConst::lea_factor, Tile::lea_scale },
+    { IrOp::mul, TileShape::imm, TileSide::either, TileConst::imm32, Tile::alu_imm },
+    { IrOp::mul, TileShape::load, TileSide::either, TileConst::any, Tile::alu_mem },
+    { IrOp::div, TileShape::imm, TileSide::rhs, TileConst::one, Tile::same },
+    { IrOp::div, TileShape::imm, TileSide::rhs, TileConst::pow2, Tile::sar },
+    { IrOp::store, TileShape::imm, TileSide::rhs, TileConst::imm32, Tile::store_imm },
+    { IrOp::exit, TileShape::imm, TileSide::lhs, TileConst::any, Tile::exit_imm },
+};
 
 class Generator {
 public:
-    inline explicit Generator(NodeProg prog)
-        : m_prog(std::move(prog))
+    inline explicit Generator(IrProg ir, CodegenMode mode = CodegenMode::regs,
+                              CodegenTarget target = CodegenTarget::executable)
+        : m_owned_ir(std::move(ir))
+        , m_ir(m_owned_ir)
+        , m_mode(mode)
+        , m_target(target)
+    {
+    }
+
+    // make it non-copyable
+    inline Generator(const Generator& other) = delete;
+
+    inline Generator operator=(const Generator& other) = delete;
+
+    // Below this many IR instructions, `gen_prog(ThreadPool&)` generates serially; also its smallest range.
+    static constexpr size_t PARALLEL_MIN_INSTRS = 64 * 1024;
+
+    // QWORD [rbp - 8 * (slot + 1)]; `let` slots come first, register spill slots after them
+    [[nodiscard]] static inline Operand slot_operand(uint32_t slot)
     {
+        return Operand::mem(Reg::rbp, -8 * (static_cast<int32_t>(slot) + 1));
     }
 
-    void gen_term(const NodeTerm* term)
+    // dst = dst <op> src; division clobbers rax and rdx, so neither may be `src`
+    void gen_bin_op(IrOp op, Reg dst, Reg src)
     {
-        struct TermVisitor {
-            Generator* gen;
-            void operator()(const NodeTermIntLit* term_int_lit) const
-            {
-                gen->m_output << "    mov rax, " << term_int_lit->int_lit.value.value() << "\n";
-                gen->push("rax");
+        switch (op) {
+        case IrOp::add:
+            emit(Op::add, Operand::r(dst), Operand::r(src));
+            break;
+        case IrOp::sub:
+            emit(Op::sub, Operand::r(dst), Operand::r(src));
+            break;
+        case IrOp::mul:
+            emit(Op::imul, Operand::r(dst), Operand::r(src));
+            break;
+        case IrOp::div:
+            // signed rdx:rax / src, quotient in rax
+            assert(src != Reg::rax && src != Reg::rdx);
+            if (dst != Reg::rax) {
+                emit(Op::mov, Operand::r(Reg::rax), Operand::r(dst));
             }
-            /**
-             * Offset(in bytes) stack pointer by 2, copy value, and push copied to top of stack
-             * stack_loc,size,etc use 1 (as 64bits) and 8*8 // See 01:20:00 (Compiler Pt.3)
-             */
-            void operator()(const NodeTermIdent* term_ident) const
-            {
-                if (!gen->m_vars.contains(term_ident->ident.value.value())) {
-                    std::cerr << "Undeclared identifier: " << term_ident->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                const auto& var = gen->m_vars.at(term_ident->ident.value.value());
-                std::stringstream offset;
-                /*
-                 * 64bits - quad word 4 bytes in 32bits and 8 bytes in 64bits
-                 * when second var is called instead of the prior. let x = 7; let y = 8; exit(y];
-                 */
-                auto BIT_MULTIPLIER = 8, OFF_BY_ONE = 1;
-                /*
-                 * Push what is 8bytes further from the stack top(y), by copying it(x) to the top
-                 * Pop it(x_copy) into `rdi` which will then execute it in exit(x_copy)
-                 */
-                offset << "QWORD [rsp + " << (gen->m_stack_size - var.stack_loc - OFF_BY_ONE) * BIT_MULTIPLIER << "]\n";
-                gen->push(offset.str());
-            }
-        };
-        TermVisitor visitor({ .gen = this });
-        std::visit(visitor, term->var);
-    }
-
-    void gen_bin_expr(const NodeBinExpr* bin_expr)
-    {
-        struct BinExprVisitor {
-            Generator* gen;
-            void operator()(const NodeBinExprAdd* add) const
-            {
-                gen->gen_expr(add->lhs);
-                gen->gen_expr(add->rhs);
-                gen->pop("rax");
-                gen->pop("rbx");
-                gen->m_output << "    add rax, rbx\n";
-                gen->push("rax");
-            }
-        };
-        BinExprVisitor visitor { .gen = this };
-        std::visit(visitor, bin_expr->var);
-    }
-
-    void gen_expr(const NodeExpr* expr)
-    {
-        struct ExprVisitor {
-            Generator* gen;
-            void operator()(const NodeTerm* term) const
-            {
-                gen->gen_term(term);
-            }
-            void operator()(const NodeBinExpr* bin_term) const
-            {
-                gen->gen_bin_expr(bin_term);
-            }
-        };
-        ExprVisitor visitor { .gen = this };
-        std::visit(visitor, expr->var);
-    }
-
-    void gen_stmt(const NodeStmt* stmt)
-    {
-        struct StmtVisitor {
-            Generator* gen;
-            void operator()(const NodeStmtExit* stmt_exit) const
-            {
-                gen->gen_expr(stmt_exit->expr);
-                gen->m_output << "    mov rax, 60\n";
-                gen->pop("rdi");
-                gen->m_output << "    syscall\n";
-            }
-            void operator()(const NodeStmtLet* stmt_let) const
-            {
-                if (gen->m_vars.contains(stmt_let->ident.value.value())) {
-                    std::cerr << "Identifier already used: " << stmt_let->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
+            emit(Op::cqo);
+            emit(Op::idiv, Operand::r(src));
+            if (dst != Reg::rax) {
+                emit(Op::mov, Operand::r(dst), Operand::r(Reg::rax));
+            }
+            break;
+        default:
+            assert(false && "not a binary operation");
+        }
+    }
+
+    /**
+     * Every value is pushed when it is defined and popped by its only use. The IR is a tree evaluated in order, so the
+     * operands of a binary operation are always the two values on top of the stack; the later-defined one is on top.
+     */
+    void gen_stack(size_t i)
+    {
+        const IrArgs& arg = m_ir.args[i];
+        switch (m_ir.ops[i]) {
+        case IrOp::imm:
+            emit(mov_imm(Reg::rax, m_ir.imm_value(i)));
+            push(Operand::r(Reg::rax));
+            break;
+        case IrOp::load:
+            push(slot_operand(arg.a));
+            break;
+        case IrOp::store:
+            pop(Reg::rax);
+            emit(Op::mov, slot_operand(arg.a), Operand::r(Reg::rax));
+            break;
+        case IrOp::exit:
+            if (m_target == CodegenTarget::jit) {
+                pop(Reg::rax);
+                gen_jit_return();
+                break;
+            }
+            emit(mov_imm(Reg::rax, 60));
+            pop(Reg::rdi);
+            emit(Op::syscall);
+            break;
+        default:
+            // lhs in rax, rhs in rbx
+            pop(arg.b > arg.a ? Reg::rbx : Reg::rax);
+            pop(arg.b > arg.a ? Reg::rax : Reg::rbx);
+            gen_bin_op(m_ir.ops[i], Reg::rax, Reg::rbx);
+            push(Operand::r(Reg::rax));
+            break;
+        }
+    }
+
+    /**
+     * Linear scan over the instruction list, in the tiles `select_tiles` picked. Each value has exactly one use, so it
+     * is live from its definition to that use; a binary operation computes into its lhs register and frees the rhs
+     * one, and a tile with one register operand computes in that operand's register. When `imm`/`load` find the pool
+     * empty, the live value whose use is furthest away is moved to a spill slot and reloaded into the scratch register
+     * when it is finally used (only one operand can be spilled: the other is the last value defined before the use,
+     * covered instructions define none).
+     */
+    void gen_regs(size_t i)
+    {
+        const IrArgs& arg = m_ir.args[i];
+        const Selection& sel = m_sel[i - m_base];
+        if (sel.tile == Tile::covered) {
+            return;
+        }
+        switch (m_ir.ops[i]) {
+        case IrOp::imm:
+            emit(mov_imm(def_reg(i), m_ir.imm_value(i)));
+            break;
+        case IrOp::load:
+            emit(Op::mov, Operand::r(def_reg(i)), slot_operand(arg.a));
+            break;
+        case IrOp::store:
+            if (sel.tile == Tile::store_imm) {
+                emit(Op::mov, slot_operand(arg.a), Operand::imm(sel.k));
+                break;
+            }
+            emit(Op::mov, slot_operand(arg.a), Operand::r(use_reg(arg.b)));
+            release(arg.b);
+            break;
+        case IrOp::exit: {
+            const Reg status = m_target == CodegenTarget::jit ? Reg::rax : Reg::rdi;
+            if (sel.tile == Tile::exit_imm) {
+                emit(mov_imm(status, sel.k));
+            }
+            else {
+                const Reg reg = use_reg(arg.a);
+                release(arg.a);
+                if (reg != status) {
+                    emit(Op::mov, Operand::r(status), Operand::r(reg));
                 }
-                gen->m_vars.insert({ stmt_let->ident.value.value(), Var { .stack_loc = gen->m_stack_size } });
-                gen->gen_expr(stmt_let->expr);
             }
-        };
+            if (m_target == CodegenTarget::jit) {
+                gen_jit_return();
+                break;
+            }
+            emit(mov_imm(Reg::rax, 60));
+            emit(Op::syscall);
+            break;
+        }
+        default:
+            if (sel.tile == Tile::reg) {
+                gen_regs_bin_op(i);
+            }
+            else {
+                gen_tile(i);
+            }
+            break;
+        }
+    }
+
+    // `op r, r` (or `idiv r`), both operands in registers.
+    void gen_regs_bin_op(size_t i)
+    {
+        const IrArgs& arg = m_ir.args[i];
+        const Reg lhs = use_reg(arg.a);
+        const Reg rhs = use_reg(arg.b);
+        gen_bin_op(m_ir.ops[i], lhs, rhs);
+        // the result stays in whichever pool register survives
+        if (lhs == SCRATCH_REG) {
+            emit(Op::mov, Operand::r(rhs), Operand::r(SCRATCH_REG));
+            loc(i) = loc(arg.b);
+            release(arg.a);
+        }
+        else {
+            loc(i) = loc(arg.a);
+            release(arg.b);
+        }
+        m_active.push_back(i);
+        std::erase(m_active, arg.a);
+        std::erase(m_active, arg.b);
+    }
+
+    // A binary operation in any tile but `reg`.
+    void gen_tile(size_t i)
+    {
+        const IrOp op = m_ir.ops[i];
+        const auto& sel = m_sel[i - m_base];
+        switch (sel.tile) {
+        case Tile::same:
+            take_reg(sel.x, i);
+            break;
+        case Tile::alu_imm:
+            emit(alu_op(op), Operand::r(take_reg(sel.x, i)), Operand::imm(sel.k));
+            break;
+        case Tile::alu_mem:
+            emit(alu_op(op), Operand::r(take_reg(sel.x, i)), slot_operand(static_cast<uint32_t>(sel.k)));
+            break;
+        case Tile::inc:
+            emit(Op::inc, Operand::r(take_reg(sel.x, i)));
+            break;
+        case Tile::dec:
+            emit(Op::dec, Operand::r(take_reg(sel.x, i)));
+            break;
+        case Tile::neg:
+            emit(Op::neg, Operand::r(take_reg(sel.x, i)));
+            break;
+        case Tile::zero: {
+            const Reg reg = take_reg(sel.x, i);
+            emit(mov_imm(reg, 0));
+            break;
+        }
+        case Tile::shl:
+            emit(Op::shl, Operand::r(take_reg(sel.x, i)), Operand::imm(sel.k));
+            break;
+        case Tile::sar: {
+            // add 2^k - 1 to a negative dividend first, so the shift rounds toward zero; rdx is free outside `idiv`
+            const Reg reg = take_reg(sel.x, i);
+            emit(Op::mov, Operand::r(Reg::rdx), Operand::r(reg));
+            if (sel.k > 1) {
+                emit(Op::sar, Operand::r(Reg::rdx), Operand::imm(63));
+            }
+            emit(Op::shr, Operand::r(Reg::rdx), Operand::imm(64 - sel.k));
+            emit(Op::add, Operand::r(reg), Operand::r(Reg::rdx));
+            emit(Op::sar, Operand::r(reg), Operand::imm(sel.k));
+            break;
+        }
+        case Tile::lea_scale: {
+            const Reg reg = take_reg(sel.x, i);
+            emit(Op::lea, Operand::r(reg), Operand::addr(reg, reg, static_cast<uint8_t>(sel.k - 1)));
+            break;
+        }
+        case Tile::lea_add: {
+            const Reg index = use_reg(sel.x);
+            const Reg base = use_reg(sel.y);
+            // `lea` can write any register: the result stays in whichever operand register is from the pool
+            const bool in_index = index != SCRATCH_REG;
+            emit(Op::lea, Operand::r(in_index ? index : base), Operand::addr(base, index, static_cast<uint8_t>(sel.k)));
+            const VReg kept = in_index ? sel.x : sel.y;
+            const VReg dropped = in_index ? sel.y : sel.x;
+            loc(i) = loc(kept);
+            release(dropped);
+            std::erase(m_active, kept);
+            m_active.push_back(i);
+            break;
+        }
+        default:
+            assert(false && "not a binary operation tile");
+        }
+    }
 
-        StmtVisitor visitor({ .gen = this });
-        std::visit(visitor, stmt->var);
+    // Undo the JIT prologue from wherever the stack is (`exit` can run with values still pushed) and return to the
+    // host.
+    void gen_jit_return()
+    {
+        emit(Op::mov, Operand::r(Reg::rsp), Operand::r(Reg::rbp));
+        pop(Reg::rbp);
+        pop(Reg::rbx);
+        emit(Op::ret);
     }
 
-    [[nodiscard]] inline std::string gen_prog()
+    // Returns the program as instructions; render with `write_nasm()` or assemble with `Encoder`.
+    [[nodiscard]] inline std::vector<Instr> gen_prog()
     {
-        m_output << "global _start\n_start:\n";
+        std::vector<Instr> body = gen_body();
+        std::vector<Instr> prologue = gen_prologue(frame_slots(), m_target);
+        body.insert(body.begin(), prologue.begin(), prologue.end());
+        return body;
+    }
 
-        for (const NodeStmt* stmt : m_prog.stmts) {
-            gen_stmt(stmt);
+    /**
+     * Same instructions as `gen_prog()`, generated on `pool`. No state crosses a statement boundary: every `let` slot
+     * was fixed by the lowering (its frame layout pass), values never outlive their statement, so the stack and the
+     * register pool are empty between statements, and spill slots are numbered from 0 in every statement. So ranges
+     * of statements are generated independently, each by its own `Generator` on the shared IR, and concatenated in
+     * order behind a prologue sized for the largest spill count of any range.
+     */
+    [[nodiscard]] inline std::vector<Instr> gen_prog(ThreadPool& pool)
+    {
+        const std::vector<size_t> cuts = range_cuts(pool.size() * 4);
+        if (cuts.size() <= 2) {
+            return gen_prog();
         }
-        /*
-         * If no explicit `exit()` exit with 0, else this is unreachable :)
-         */
-        m_output << "    mov rax, 60\n";
-        m_output << "    mov rdi, 0\n";
-        m_output << "    syscall\n";
+        const size_t ranges = cuts.size() - 1;
+        std::vector<std::vector<Instr>> bodies(ranges);
+        std::vector<uint32_t> spill_slots(ranges, 0);
+        pool.parallel_for(ranges, PhaseTimer::counted([&](size_t i) {
+            Generator range(&m_ir, m_mode, m_target);
+            bodies[i] = range.gen_stmts(cuts[i], cuts[i + 1]);
+            spill_slots[i] = range.m_spill_slots;
+        }));
+        m_spill_slots = *std::max_element(spill_slots.begin(), spill_slots.end());
+
+        std::vector<Instr> prog = gen_prologue(frame_slots(), m_target);
+        size_t total = prog.size();
+        for (const std::vector<Instr>& body : bodies) {
+            total += body.size();
+        }
+        prog.reserve(total);
+        for (std::vector<Instr>& body : bodies) {
+            prog.insert(prog.end(), body.begin(), body.end());
+            body = {};
+        }
+        return prog;
+    }
+
+    // The program without its prologue; `frame_slots()` is known afterwards.
+    [[nodiscard]] inline std::vector<Instr> gen_body()
+    {
+        assert((m_ir.size() == 0 || (!m_ir.stmt_begin.empty() && m_ir.stmt_begin[0] == 0))
+               && "IR outside any statement, see `IrProg::begin_stmt`");
+        return gen_stmts(0, m_ir.stmt_begin.size());
+    }
 
-        return m_output.str();
+    // `let` slots plus register spill slots
+    [[nodiscard]] inline size_t frame_slots() const
+    {
+        return static_cast<size_t>(m_ir.slot_count) + m_spill_slots;
+    }
+
+    // Set up a frame of `slots` QWORDs (and for JIT code, save the callee-saved registers the body uses).
+    [[nodiscard]] static inline std::vector<Instr> gen_prologue(size_t slots, CodegenTarget target)
+    {
+        if (slots > INT32_MAX / 8 - 1) {
+            throw CompileError("Too many variables: " + std::to_string(slots));
+        }
+        // JIT code always sets up a frame: rbx and rbp are callee-saved, and `exit` unwinds through rbp
+        std::vector<Instr> prologue;
+        if (target == CodegenTarget::jit) {
+            prologue.push_back({ .op = Op::push, .dst = Operand::r(Reg::rbx) });
+        }
+        if (slots > 0 || target == CodegenTarget::jit) {
+            prologue.push_back({ .op = Op::push, .dst = Operand::r(Reg::rbp) });
+            prologue.push_back({ .op = Op::mov, .dst = Operand::r(Reg::rbp), .src = Operand::r(Reg::rsp) });
+        }
+        if (slots > 0) {
+            prologue.push_back(
+                { .op = Op::sub, .dst = Operand::r(Reg::rsp), .src = Operand::imm(static_cast<int64_t>(slots * 8)) });
+        }
+        return prologue;
     }
 
 private:
-    struct Var {
-        size_t stack_loc;
-        // TODO: include types for static typing
+    // Shares `*shared_ir` with the generator that made it, see `gen_prog(ThreadPool&)`.
+    inline Generator(const IrProg* shared_ir, CodegenMode mode, CodegenTarget target)
+        : m_ir(*shared_ir)
+        , m_mode(mode)
+        , m_target(target)
+    {
+    }
+
+    // The tile `select_tiles` picked for one instruction; `x`/`y` are the values it reads from registers.
+    struct Selection {
+        Tile tile = Tile::reg;
+        VReg x = 0;
+        VReg y = 0;
+        int64_t k = 0; // the constant, shift count, scale or slot
+    };
+
+    // Where a value lives while it is live: a pool register, or a spill slot once evicted.
+    struct Location {
+        Reg reg = Reg::rax;
+        bool spilled = false;
+        uint32_t slot = 0;
     };
 
-    const NodeProg m_prog;
-    std::stringstream m_output;
-    size_t m_stack_size = 0; // Our own stack pointer at compile time to move around the entity offset of the
-                             // penultimate item. copy that and add it to top of stack? See 01:01:30 (Compiler Pt.3)
-                             // limited numbers of registers wants us to utilize the Stack
-    std::unordered_map<std::string, Var> m_vars {}; // track variable's positions in stack
+    // Registers values are allocated from. rax/rdx are left out for `idiv`, rbx is the spill reload scratch, rsp/rbp
+    // are the stack.
+    static constexpr Reg REG_POOL[] = { Reg::rcx, Reg::rsi, Reg::rdi, Reg::r8, Reg::r9, Reg::r10, Reg::r11 };
+    static constexpr Reg SCRATCH_REG = Reg::rbx;
+
+    const IrProg m_owned_ir; // empty in a range generator, which reads its parent's
+    const IrProg& m_ir;
+    const CodegenMode m_mode;
+    const CodegenTarget m_target;
+    std::vector<Instr> m_instrs;
+    uint32_t m_free_regs = (1u << std::size(REG_POOL)) - 1; // bit i set: REG_POOL[i] is free
+    std::vector<uint32_t> m_use; // index of the instruction that reads each value, from `m_base` on
+    std::vector<Location> m_loc; // per value, from `m_base` on
+    std::vector<Selection> m_sel; // per instruction, from `m_base` on
+    size_t m_base = 0; // first instruction of the range being generated
+    std::vector<VReg> m_active; // values currently held in registers
+    std::vector<uint32_t> m_free_spill_slots;
+    uint32_t m_stmt_spill_slots = 0; // used by the current statement
+    uint32_t m_spill_slots = 0; // most any statement used
 
-    void push(const std::string& reg)
+    // First IR instruction of statement `stmt`, or the end for one past the last.
+    [[nodiscard]] inline size_t stmt_start(size_t stmt) const
     {
-        m_output << "    push " << reg << "\n";
-        m_stack_size++;
+        return stmt < m_ir.stmt_begin.size() ? m_ir.stmt_begin[stmt] : m_ir.size();
     }
 
-    void pop(const std::string& reg)
+    // Code for statements `[first, last)`.
+    inline std::vector<Instr> gen_stmts(size_t first, size_t last)
     {
-        m_output << "    pop " << reg << "\n";
-        m_stack_size--;
+        if (m_mode == CodegenMode::regs) {
+            compute_uses(stmt_start(first), stmt_start(last));
+            select_tiles(stmt_start(first), stmt_start(last));
+        }
+        for (size_t stmt = first; stmt < last; stmt++) {
+            // every spill slot was released by the end of the last statement; renumber so that a statement's code
+            // doesn't depend on what came before it
+            m_free_spill_slots.clear();
+            m_stmt_spill_slots = 0;
+            for (size_t i = stmt_start(stmt); i < stmt_start(stmt + 1); i++) {
+                if (m_mode == CodegenMode::stack) {
+                    gen_stack(i);
+                }
+                else {
+                    gen_regs(i);
+                }
+            }
+        }
+        return std::move(m_instrs);
+    }
+
+    // Statement indices that split the program into at most `max_ranges` ranges of about equal IR size, none smaller
+    // than `PARALLEL_MIN_INSTRS`: 0, the cuts, the statement count.
+    [[nodiscard]] inline std::vector<size_t> range_cuts(size_t max_ranges) const
+    {
+        const std::vector<uint32_t>& begins = m_ir.stmt_begin;
+        const size_t ranges = std::min(max_ranges, m_ir.size() / PARALLEL_MIN_INSTRS);
+        std::vector<size_t> cuts { 0 };
+        for (size_t i = 1; i < ranges; i++) {
+            const size_t target = m_ir.size() / ranges * i;
+            const auto stmt
+                = static_cast<size_t>(std::lower_bound(begins.begin(), begins.end(), target) - begins.begin());
+            if (stmt > cuts.back() && stmt < begins.size()) {
+                cuts.push_back(stmt);
+            }
+        }
+        cuts.push_back(begins.size());
+        return cuts;
+    }
+
+    inline void compute_uses(size_t begin, size_t end)
+    {
+        m_base = begin;
+        m_use.assign(end - begin, 0);
+        m_loc.assign(end - begin, {});
+        for (size_t i = begin; i < end; i++) {
+            const IrOp op = m_ir.ops[i];
+            if (op == IrOp::store) {
+                m_use[m_ir.args[i].b - begin] = static_cast<uint32_t>(i);
+            }
+            else if (op == IrOp::exit) {
+                m_use[m_ir.args[i].a - begin] = static_cast<uint32_t>(i);
+            }
+            else if (IrProg::is_bin_op(op)) {
+                m_use[m_ir.args[i].a - begin] = static_cast<uint32_t>(i);
+                m_use[m_ir.args[i].b - begin] = static_cast<uint32_t>(i);
+            }
+        }
+    }
+
+    /**
+     * Greedy bottom-up instruction selection: operands come before their users, so when instruction `i` is reached its
+     * operands' tiles are final, and the first rule in `TILE_RULES` that matches `i` covers the operand it names. Each
+     * value has one use, so covering it never duplicates work.
+     */
+    inline void select_tiles(size_t begin, size_t end)
+    {
+        m_sel.assign(end - begin, {});
+        for (size_t i = begin; i < end; i++) {
+            for (const TileRule& rule : TILE_RULES) {
+                if (rule.op == m_ir.ops[i] && (try_tile(i, rule, TileSide::rhs) || try_tile(i, rule, TileSide::lhs))) {
+                    break;
+                }
+            }
+        }
+    }
+
+    // Apply `rule` to instruction `i` with its `side` operand as the one the rule covers, if it fits.
+    inline bool try_tile(size_t i, const TileRule& rule, TileSide side)
+    {
+        if (rule.side != side && rule.side != TileSide::either) {
+            return false;
+        }
+        const IrArgs& arg = m_ir.args[i];
+        const IrOp op = m_ir.ops[i];
+        VReg v;
+        VReg other = 0;
+        if (op == IrOp::store) {
+            if (side != TileSide::rhs) {
+                return false;
+            }
+            v = arg.b;
+        }
+        else if (op == IrOp::exit) {
+            if (side != TileSide::lhs) {
+                return false;
+            }
+            v = arg.a;
+        }
+        else {
+            v = side == TileSide::rhs ? arg.b : arg.a;
+            other = side == TileSide::rhs ? arg.a : arg.b;
+        }
+
+        int64_t k = 0;
+        switch (rule.shape) {
+        case TileShape::imm:
+            if (m_ir.ops[v] != IrOp::imm) {
+                return false;
+            }
+            k = m_ir.imm_value(v);
+            break;
+        case TileShape::load:
+            if (m_ir.ops[v] != IrOp::load) {
+                return false;
+            }
+            k = m_ir.args[v].a;
+            break;
+        case TileShape::scaled:
+            if (m_ir.ops[v] != IrOp::mul || sel(v).tile != Tile::shl || sel(v).k > 3) {
+                return false;
+            }
+            k = int64_t { 1 } << sel(v).k;
+            break;
+        }
+        if (!tile_const_matches(rule.accepts, k)) {
+            return false;
+        }
+
+        if (rule.shape == TileShape::scaled) {
+            // the `shl` disappears into the address: its operand is now read by `i`
+            const VReg index = sel(v).x;
+            m_use[index - m_base] = static_cast<uint32_t>(i);
+            sel(v).tile = Tile::covered;
+            sel(i) = { .tile = rule.tile, .x = index, .y = other, .k = k };
+            return true;
+        }
+        if (rule.tile == Tile::shl || rule.tile == Tile::sar) {
+            k = std::countr_zero(static_cast<uint64_t>(k));
+        }
+        sel(v).tile = Tile::covered;
+        sel(i) = { .tile = rule.tile, .x = other, .k = k };
+        return true;
+    }
+
+    inline Selection& sel(VReg v)
+    {
+        return m_sel[v - m_base];
+    }
+
+    inline Location& loc(VReg v)
+    {
+        return m_loc[v - m_base];
+    }
+
+    inline void emit(Op op, Operand dst = {}, Operand src = {})
+    {
+        m_instrs.push_back({ .op = op, .dst = dst, .src = src });
+    }
+
+    inline void emit(Instr instr)
+    {
+        m_instrs.push_back(instr);
+    }
+
+    // `add`/`sub`/`imul` for a binary operation with a register destination.
+    static inline Op alu_op(IrOp op)
+    {
+        switch (op) {
+        case IrOp::add:
+            return Op::add;
+        case IrOp::sub:
+            return Op::sub;
+        case IrOp::mul:
+            return Op::imul;
+        default:
+            assert(false && "no single-instruction form");
+            return Op::add;
+        }
+    }
+
+    // `v` computes in place in the register of `x`, its only register operand, which dies here; a spilled `x` is
+    // reloaded into a fresh register rather than the scratch one, which the next reload may need.
+    inline Reg take_reg(VReg x, VReg v)
+    {
+        if (loc(x).spilled) {
+            const Reg reg = def_reg(v);
+            emit(Op::mov, Operand::r(reg), slot_operand(m_ir.slot_count + loc(x).slot));
+            release(x);
+            return reg;
+        }
+        loc(v) = loc(x);
+        std::replace(m_active.begin(), m_active.end(), x, static_cast<VReg>(v));
+        return loc(v).reg;
+    }
+
+    void push(Operand operand)
+    {
+        emit(Op::push, operand);
+    }
+
+    void pop(Reg reg)
+    {
+        emit(Op::pop, Operand::r(reg));
+    }
+
+    // Register for the value instruction `v` defines, spilling another value if the pool is empty.
+    inline Reg def_reg(VReg v)
+    {
+        if (m_free_regs == 0) {
+            spill_furthest();
+        }
+        const int index = std::countr_zero(m_free_regs);
+        m_free_regs &= ~(1u << index);
+        loc(v) = { .reg = REG_POOL[index] };
+        m_active.push_back(v);
+        return REG_POOL[index];
+    }
+
+    inline void spill_furthest()
+    {
+        auto victim = m_active.begin();
+        for (auto it = m_active.begin(); it != m_active.end(); ++it) {
+            if (m_use[*it - m_base] > m_use[*victim - m_base]) {
+                victim = it;
+            }
+        }
+        assert(victim != m_active.end() && "nothing to spill");
+        const VReg v = *victim;
+        m_active.erase(victim);
+
+        uint32_t slot;
+        if (!m_free_spill_slots.empty()) {
+            slot = m_free_spill_slots.back();
+            m_free_spill_slots.pop_back();
+        }
+        else {
+            slot = m_stmt_spill_slots++;
+            m_spill_slots = std::max(m_spill_slots, m_stmt_spill_slots);
+        }
+        const Reg reg = loc(v).reg;
+        emit(Op::mov, slot_operand(m_ir.slot_count + slot), Operand::r(reg));
+        free_reg(reg);
+        loc(v) = { .spilled = true, .slot = slot };
+    }
+
+    // Register holding `v` for its use; a spilled value is reloaded into the scratch register.
+    inline Reg use_reg(VReg v)
+    {
+        if (loc(v).spilled) {
+            emit(Op::mov, Operand::r(SCRATCH_REG), slot_operand(m_ir.slot_count + loc(v).slot));
+            return SCRATCH_REG;
+        }
+        return loc(v).reg;
+    }
+
+    // `v` has been used: give back its register or spill slot.
+    inline void release(VReg v)
+    {
+        if (loc(v).spilled) {
+            m_free_spill_slots.push_back(loc(v).slot);
+        }
+        else {
+            free_reg(loc(v).reg);
+            std::erase(m_active, v);
+        }
+    }
+
+    inline void free_reg(Reg reg)
+    {
+        for (size_t i = 0; i < std::size(REG_POOL); i++) {
+            if (REG_POOL[i] == reg) {
+                m_free_regs |= 1u << i;
+                return;
+            }
+        }
     }
 };
 
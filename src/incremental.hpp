@@ -0,0 +1,596 @@
+#pragma once
+
+// Incremental rebuilds for `--watch`. The program is kept as a list of units, each one statement's source text up to
+// and including its `;`. Tokens never span a `;`, so a unit lexes and parses on its own exactly as it does inside the
+// whole file, and IR values never cross a statement, so a unit's machine code only depends on its AST and the frame
+// slots of the names it uses. A new buffer is diffed against the previous one; only the units the edit touches are
+// relexed and reparsed, and only units whose AST or slots changed are generated again. The executable is the prologue
+// followed by every unit's code.
+//
+// Slots aren't numbered in declaration order as in a normal build: a name keeps its slot for as long as some `let`
+// declares it, so inserting or deleting a `let` doesn't move every later variable and regenerate the rest of the file.
+//
+// Watch builds skip the AST optimizer: constant propagation and dead-let elimination look across statements, which
+// would turn every edit back into a whole-program rebuild. Peephole rules still run, on each unit's code.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "diagnostics.hpp"
+#include "elf.hpp"
+#include "generation.hpp"
+#include "io.hpp"
+#include "ir.hpp"
+#include "output.hpp"
+#include "parser.hpp"
+#include "peephole.hpp"
+#include "tokenization.hpp"
+#include "x86_64.hpp"
+
+class IncrementalCompiler {
+public:
+    // What the last `update` had to redo.
+    struct Stats {
+        size_t relexed_bytes = 0;
+        size_t reparsed_stmts = 0;
+        size_t regenerated_stmts = 0;
+        size_t stmts = 0;
+        bool rescoped = false; // `let`s were added, removed or renamed: every unit's names were resolved again
+    };
+
+    // Uses the codegen mode and peephole settings of `options`; the target is always an executable.
+    inline explicit IncrementalCompiler(CompileOptions options = {})
+        : m_options(std::move(options))
+    {
+        IrProg exit_ir;
+        exit_ir.begin_stmt();
+        exit_ir.push(IrOp::exit, { .a = exit_ir.push_imm(0) });
+        m_exit_code = gen_code(std::move(exit_ir), nullptr);
+    }
+
+    /**
+     * Bring the program up to date with `source` and write the executable to `path`. The units are only replaced once
+     * the edited region parses, so after a syntax error the next call is still diffed against the last buffer that
+     * did.
+     */
+    inline CompileResult update(std::string source, const std::string& path)
+    {
+        CompileResult result;
+        m_stats = {};
+        try {
+            if (source.size() > UINT32_MAX) {
+                throw CompileError("Source too large: " + std::to_string(source.size()) + " bytes (max "
+                                   + std::to_string(UINT32_MAX) + ")");
+            }
+            if (source != m_src) {
+                reparse(std::move(source));
+            }
+            resolve();
+            regenerate();
+            if (!write_executable(path)) {
+                throw CompileError("Failed to write executable `" + path + "`");
+            }
+        }
+        catch (const CompileError& error) {
+            Diagnostic diagnostic { .message = error.what(), .offset = error.offset() };
+            diagnostic.locate(m_failed_src.empty() ? std::string_view(m_src) : std::string_view(m_failed_src));
+            result.diagnostics.push_back(std::move(diagnostic));
+        }
+        m_failed_src.clear();
+        m_stats.stmts = static_cast<size_t>(
+            std::count_if(m_units.begin(), m_units.end(), [](const Unit& unit) { return unit.has_stmt(); }));
+        return result;
+    }
+
+    [[nodiscard]] inline const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    struct Unit {
+        uint32_t begin = 0; // in `m_src`
+        uint32_t size = 0; // through the `;`, except for trailing whitespace, which is a unit without a statement
+        std::vector<NodeKind> kinds {}; // the statement's nodes in post-order, root last; node ids and identifier
+        std::vector<NodeData> data {}; // offsets are relative to the unit; an identifier's is its offset and length
+        uint32_t lets_before = 0; // a name it reads must be declared by one of them
+        std::vector<uint32_t> slots {}; // what the code was generated for: the slot of every name read, then its own
+        uint32_t let_slots = 0; // and the `let` slot count, which the spill slots are placed after
+        uint32_t spill_slots = 0;
+        std::vector<uint8_t> code {};
+        bool stale = true;
+
+        [[nodiscard]] inline bool has_stmt() const
+        {
+            return !kinds.empty();
+        }
+
+        [[nodiscard]] inline NodeId root() const
+        {
+            return static_cast<NodeId>(kinds.size() - 1);
+        }
+
+        [[nodiscard]] inline bool is_let() const
+        {
+            return has_stmt() && kinds.back() == NodeKind::stmt_let;
+        }
+
+        [[nodiscard]] inline bool is_exit() const
+        {
+            return has_stmt() && kinds.back() == NodeKind::stmt_exit;
+        }
+    };
+
+    // so `m_scope` can be searched with the `std::string_view`s of the current buffer
+    struct NameHash {
+        using is_transparent = void;
+
+        inline size_t operator()(std::string_view name) const
+        {
+            return std::hash<std::string_view> {}(name);
+        }
+    };
+
+    struct Binding {
+        uint32_t slot;
+        uint32_t index; // the `index`th `let` of the program
+    };
+
+    using Scope = std::unordered_map<std::string, Binding, NameHash, std::equal_to<>>;
+
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+    static constexpr size_t NOT_REUSED = SIZE_MAX;
+    static constexpr size_t LOOKAHEAD = 64;
+
+    CompileOptions m_options;
+    std::string m_src;
+    std::string m_failed_src; // the buffer an error refers to, when it isn't `m_src`
+    std::vector<Unit> m_units;
+    Scope m_scope; // every `let`
+    uint32_t m_let_slots = 0; // highest slot in `m_scope` + 1
+    bool m_resolved = false; // `m_scope` and every unit's `lets_before` match `m_units`
+    std::vector<uint32_t> m_slots_scratch; // `resolve_unit`'s, to not allocate per unit
+    SymbolTable m_unit_symbols; // `gen_unit`'s, same
+    std::vector<uint8_t> m_exit_code; // the implicit `exit(0)`
+    Stats m_stats;
+
+    [[nodiscard]] inline std::string_view unit_text(const Unit& unit) const
+    {
+        return std::string_view(m_src).substr(unit.begin, unit.size);
+    }
+
+    // The name a unit's `let` declares.
+    [[nodiscard]] inline std::string_view let_name(const Unit& unit, std::string_view src) const
+    {
+        const NodeData& ident = unit.data[unit.data.back().lhs];
+        return src.substr(unit.begin + ident.lhs, ident.rhs);
+    }
+
+    // Call `fn(name, offset in the unit)` for every identifier `unit` reads, in source order.
+    template <typename Fn>
+    inline void for_each_read(const Unit& unit, Fn fn) const
+    {
+        if (!unit.has_stmt()) {
+            return;
+        }
+        const NodeId own = unit.is_let() ? unit.data.back().lhs : unit.root();
+        for (NodeId id = 0; id < unit.root(); id++) {
+            if (unit.kinds[id] == NodeKind::ident && id != own) {
+                fn(unit_text(unit).substr(unit.data[id].lhs, unit.data[id].rhs), unit.data[id].lhs);
+            }
+        }
+    }
+
+    /**
+     * Replace the units the edit touches. The changed bytes are what's left between the common prefix and suffix of the
+     * two buffers, widened to whole units: from the start of the unit holding the first changed byte to the end of the
+     * first unit that ends, with its `;`, in the unchanged suffix (or to the end of the file). Within that region, a
+     * statement whose text is identical to one of the old units there (in order) is moved over as is, so several
+     * separate edits don't relex everything between them; only the runs of new text are lexed and parsed.
+     */
+    inline void reparse(std::string source)
+    {
+        const std::string_view old_src = m_src;
+        const size_t common = std::min(old_src.size(), source.size());
+        const size_t prefix = static_cast<size_t>(
+            std::mismatch(old_src.begin(), old_src.begin() + static_cast<std::ptrdiff_t>(common), source.begin()).first
+            - old_src.begin());
+        const size_t suffix = static_cast<size_t>(
+            std::mismatch(old_src.rbegin(), old_src.rbegin() + static_cast<std::ptrdiff_t>(common - prefix),
+                          source.rbegin())
+                .first
+            - old_src.rbegin());
+        const size_t old_end = old_src.size() - suffix;
+        const int64_t delta = static_cast<int64_t>(source.size()) - static_cast<int64_t>(old_src.size());
+
+        size_t first = 0;
+        while (first < m_units.size() && m_units[first].begin + m_units[first].size <= prefix) {
+            first++;
+        }
+        if (first == m_units.size() && first > 0 && m_units.back().begin + m_units.back().size == prefix) {
+            first--; // appended at the end: the last unit may be unterminated whitespace
+        }
+        size_t last = first; // one past the last replaced unit
+        while (last < m_units.size()) {
+            const size_t end = m_units[last].begin + m_units[last].size;
+            last++;
+            if (end > old_end || end == old_src.size()
+                || (end == old_end && source[static_cast<size_t>(static_cast<int64_t>(end) + delta) - 1] == ';')) {
+                break;
+            }
+        }
+        const size_t region_begin = first < m_units.size() ? m_units[first].begin : 0;
+        const size_t region_end = last > first
+            ? static_cast<size_t>(static_cast<int64_t>(m_units[last - 1].begin + m_units[last - 1].size) + delta)
+            : source.size();
+        const std::string_view region = std::string_view(source).substr(region_begin, region_end - region_begin);
+
+        // renamed, added or removed `let`s change slots outside the region
+        std::vector<std::string_view> old_lets;
+        for (size_t k = first; k < last; k++) {
+            if (m_units[k].is_let()) {
+                old_lets.push_back(let_name(m_units[k], old_src));
+            }
+        }
+        // The old unit a statement's text matches, at or after `next_old`. The next few are compared directly, which
+        // covers edits and small deletions; only past that is an index of all the old units' texts built.
+        std::unordered_map<std::string_view, std::vector<size_t>> old_units; // text -> indices, ascending
+        bool indexed = false;
+        const auto find_old = [&](std::string_view text, size_t next_old) -> size_t {
+            for (size_t k = next_old; k < std::min(last, next_old + LOOKAHEAD); k++) {
+                if (unit_text(m_units[k]) == text) {
+                    return k;
+                }
+            }
+            if (next_old + LOOKAHEAD >= last) {
+                return NOT_REUSED;
+            }
+            if (!indexed) {
+                for (size_t k = first; k < last; k++) {
+                    old_units[unit_text(m_units[k])].push_back(k);
+                }
+                indexed = true;
+            }
+            const auto it = old_units.find(text);
+            if (it == old_units.end()) {
+                return NOT_REUSED;
+            }
+            const auto match = std::lower_bound(it->second.begin(), it->second.end(), next_old);
+            return match == it->second.end() ? NOT_REUSED : *match;
+        };
+
+        std::vector<Unit> units;
+        std::vector<size_t> reused; // per unit: the old unit it is, or `NOT_REUSED`; moved over once everything parsed
+        size_t next_old = first;
+        size_t run_begin = region.size(); // start of the text not matched yet
+        const auto parse_run = [&](size_t run_end) {
+            if (run_begin >= run_end) {
+                return;
+            }
+            std::vector<Unit> parsed;
+            try {
+                parsed = parse_units(region.substr(run_begin, run_end - run_begin));
+            }
+            catch (const CompileError& error) {
+                if (error.offset() == CompileError::NO_OFFSET) {
+                    throw;
+                }
+                throw CompileError(error.what(), region_begin + run_begin + error.offset());
+            }
+            for (Unit& unit : parsed) {
+                unit.begin += static_cast<uint32_t>(region_begin + run_begin);
+                m_stats.reparsed_stmts += unit.has_stmt();
+                units.push_back(std::move(unit));
+                reused.push_back(NOT_REUSED);
+            }
+            m_stats.relexed_bytes += run_end - run_begin;
+            run_begin = region.size();
+        };
+        try {
+            for (size_t pos = 0; pos < region.size();) {
+                const size_t semi = region.find(';', pos);
+                const size_t end = semi == std::string_view::npos ? region.size() : semi + 1;
+                const size_t match = find_old(region.substr(pos, end - pos), next_old);
+                if (match != NOT_REUSED) {
+                    parse_run(pos);
+                    units.push_back({ .begin = static_cast<uint32_t>(region_begin + pos) });
+                    reused.push_back(match);
+                    next_old = match + 1;
+                }
+                else {
+                    run_begin = std::min(run_begin, pos);
+                }
+                pos = end;
+            }
+            parse_run(region.size());
+        }
+        catch (const CompileError&) {
+            m_failed_src = std::move(source);
+            throw;
+        }
+        for (size_t k = 0; k < units.size(); k++) {
+            if (reused[k] != NOT_REUSED) {
+                const uint32_t begin = units[k].begin;
+                units[k] = std::move(m_units[reused[k]]);
+                units[k].begin = begin;
+            }
+        }
+
+        size_t new_lets = 0;
+        for (const Unit& unit : units) {
+            if (unit.is_let()) {
+                if (new_lets >= old_lets.size() || let_name(unit, source) != old_lets[new_lets]) {
+                    m_resolved = false;
+                }
+                new_lets++;
+            }
+        }
+        if (new_lets != old_lets.size()) {
+            m_resolved = false;
+        }
+
+        if (delta != 0) {
+            for (size_t k = last; k < m_units.size(); k++) {
+                m_units[k].begin = static_cast<uint32_t>(static_cast<int64_t>(m_units[k].begin) + delta);
+            }
+        }
+        // overwrite in place as far as possible, so an edit inside one statement doesn't shift the whole list
+        const size_t replaced = last - first;
+        const size_t overlap = std::min(replaced, units.size());
+        std::move(units.begin(), units.begin() + static_cast<std::ptrdiff_t>(overlap),
+                  m_units.begin() + static_cast<std::ptrdiff_t>(first));
+        if (units.size() > replaced) {
+            m_units.insert(m_units.begin() + static_cast<std::ptrdiff_t>(last),
+                           std::make_move_iterator(units.begin() + static_cast<std::ptrdiff_t>(overlap)),
+                           std::make_move_iterator(units.end()));
+        }
+        else {
+            m_units.erase(m_units.begin() + static_cast<std::ptrdiff_t>(first + overlap),
+                          m_units.begin() + static_cast<std::ptrdiff_t>(last));
+        }
+        m_src = std::move(source);
+
+        // fast path: the new units have the same `let`s before them as the ones they replace
+        if (m_resolved) {
+            for (size_t k = first; k < first + units.size(); k++) {
+                m_units[k].lets_before
+                    = k == 0 ? 0 : m_units[k - 1].lets_before + static_cast<uint32_t>(m_units[k - 1].is_let());
+                resolve_unit(m_units[k]);
+            }
+        }
+    }
+
+    // Lex and parse `text` (whole statements) in one go, then cut the result into one unit per statement.
+    [[nodiscard]] static inline std::vector<Unit> parse_units(std::string_view text)
+    {
+        Tokenizer tokenizer(text);
+        Parser parser(tokenizer.tokenize());
+        const NodeProg prog = parser.parse_prog().value();
+
+        std::vector<Unit> units;
+        units.reserve(prog.stmts.size() + 1);
+        size_t begin = 0;
+        NodeId first_node = 0;
+        for (const NodeId stmt : prog.stmts) {
+            // every statement has exactly one `;`, its last token
+            const size_t end = text.find(';', begin) + 1;
+            Unit unit { .begin = static_cast<uint32_t>(begin), .size = static_cast<uint32_t>(end - begin) };
+            unit.kinds.assign(prog.kinds + first_node, prog.kinds + stmt + 1);
+            unit.data.assign(prog.data + first_node, prog.data + stmt + 1);
+            for (size_t id = 0; id < unit.kinds.size(); id++) {
+                NodeData& data = unit.data[id];
+                switch (unit.kinds[id]) {
+                case NodeKind::ident:
+                    // units outlive the parse's symbol table
+                    data.lhs -= static_cast<uint32_t>(begin);
+                    data.rhs = static_cast<uint32_t>(prog.symbols->name(data.rhs).size());
+                    break;
+                case NodeKind::int_lit:
+                    break;
+                case NodeKind::stmt_exit:
+                    data.lhs -= first_node;
+                    break;
+                default:
+                    data.lhs -= first_node;
+                    data.rhs -= first_node;
+                    break;
+                }
+            }
+            units.push_back(std::move(unit));
+            begin = end;
+            first_node = stmt + 1;
+        }
+        if (begin < text.size()) {
+            units.push_back(
+                { .begin = static_cast<uint32_t>(begin), .size = static_cast<uint32_t>(text.size() - begin) });
+        }
+        return units;
+    }
+
+    /**
+     * Rebuild `m_scope` after `let`s were added, removed or renamed, then give every unit the slots of the names it
+     * uses (in the fast path only the new units needed them, and `reparse` has done that). Names that are still
+     * declared keep their slots; new ones take the lowest free slots.
+     */
+    inline void resolve()
+    {
+        if (m_resolved) {
+            return;
+        }
+        m_stats.rescoped = true;
+        Scope scope;
+        scope.reserve(m_scope.size());
+        std::vector<bool> taken;
+        std::vector<Binding*> lets; // in program order
+        uint32_t index = 0;
+        for (Unit& unit : m_units) {
+            unit.lets_before = index;
+            for_each_read(unit, [&](std::string_view name, uint32_t offset) {
+                if (!scope.contains(name)) {
+                    throw CompileError("Undeclared identifier: " + std::string(name), unit.begin + offset);
+                }
+            });
+            if (!unit.is_let()) {
+                continue;
+            }
+            const std::string_view name = let_name(unit, m_src);
+            if (scope.contains(name)) {
+                throw CompileError("Identifier already used: " + std::string(name),
+                                   unit.begin + unit.data[unit.data.back().lhs].lhs);
+            }
+            uint32_t slot = NO_SLOT;
+            if (const auto old = m_scope.find(name); old != m_scope.end()) {
+                slot = old->second.slot;
+                taken.resize(std::max<size_t>(taken.size(), slot + 1), false);
+                taken[slot] = true;
+            }
+            lets.push_back(&scope.emplace(std::string(name), Binding { .slot = slot, .index = index++ }).first->second);
+        }
+        // in program order, so the layout doesn't depend on hash table iteration
+        uint32_t next_free = 0;
+        uint32_t let_slots = static_cast<uint32_t>(taken.size());
+        for (Binding* binding : lets) {
+            if (binding->slot == NO_SLOT) {
+                while (next_free < taken.size() && taken[next_free]) {
+                    next_free++;
+                }
+                binding->slot = next_free++;
+                let_slots = std::max(let_slots, next_free);
+            }
+        }
+        m_scope = std::move(scope);
+        m_let_slots = let_slots;
+        for (Unit& unit : m_units) {
+            resolve_unit(unit);
+        }
+        m_resolved = true;
+    }
+
+    // Look up every name `unit` reads and the one it declares; marks it stale if its slots changed.
+    inline void resolve_unit(Unit& unit)
+    {
+        if (!unit.has_stmt()) {
+            return;
+        }
+        std::vector<uint32_t>& slots = m_slots_scratch;
+        slots.clear();
+        for_each_read(unit, [&](std::string_view name, uint32_t offset) {
+            const auto it = m_scope.find(name);
+            if (it == m_scope.end() || it->second.index >= unit.lets_before) {
+                m_resolved = false;
+                throw CompileError("Undeclared identifier: " + std::string(name), unit.begin + offset);
+            }
+            slots.push_back(it->second.slot);
+        });
+        if (unit.is_let()) {
+            slots.push_back(m_scope.find(let_name(unit, m_src))->second.slot);
+        }
+        if (slots != unit.slots) {
+            unit.slots = slots;
+            unit.stale = true;
+        }
+    }
+
+    inline void regenerate()
+    {
+        for (Unit& unit : m_units) {
+            if (!unit.has_stmt()) {
+                continue;
+            }
+            // spill slots sit after the `let` slots
+            if (unit.stale || (unit.spill_slots > 0 && unit.let_slots != m_let_slots)) {
+                gen_unit(unit);
+                m_stats.regenerated_stmts++;
+            }
+        }
+    }
+
+    inline void gen_unit(Unit& unit)
+    {
+        // intern the unit's names on their own, and bind the ones it reads to their slots
+        SymbolTable& symbols = m_unit_symbols;
+        symbols.clear();
+        std::vector<NodeData> data = unit.data;
+        std::vector<uint32_t> slots;
+        const NodeId own = unit.is_let() ? unit.data.back().lhs : unit.root();
+        size_t used = 0;
+        for (NodeId id = 0; id < unit.root(); id++) {
+            if (unit.kinds[id] != NodeKind::ident) {
+                continue;
+            }
+            data[id].rhs = symbols.intern(unit_text(unit).substr(data[id].lhs, data[id].rhs));
+            slots.resize(symbols.size(), IrLowering::NO_SLOT);
+            if (id != own) {
+                slots[data[id].rhs] = unit.slots[used++];
+            }
+        }
+
+        NodeProg prog;
+        prog.src = unit_text(unit);
+        prog.symbols = &symbols;
+        prog.kinds = unit.kinds.data();
+        prog.data = data.data();
+        prog.node_count = static_cast<uint32_t>(unit.kinds.size());
+        prog.stmts = { unit.root() };
+        // a `let`'s own slot is the last one
+        IrProg ir = IrLowering(prog, std::move(slots), unit.is_let() ? unit.slots.back() : 0).lower();
+        ir.slot_count = m_let_slots;
+        uint32_t spill_slots = 0;
+        unit.code = gen_code(std::move(ir), &spill_slots);
+        unit.spill_slots = spill_slots;
+        unit.let_slots = m_let_slots;
+        unit.stale = false;
+    }
+
+    [[nodiscard]] inline std::vector<uint8_t> gen_code(IrProg ir, uint32_t* spill_slots) const
+    {
+        const uint32_t let_slots = ir.slot_count;
+        Generator generator(std::move(ir), m_options.codegen, CodegenTarget::executable);
+        std::vector<Instr> instrs = generator.gen_body();
+        if (spill_slots != nullptr) {
+            *spill_slots = static_cast<uint32_t>(generator.frame_slots() - let_slots);
+        }
+        if (m_options.peephole) {
+            PeepholeOptimizer(m_options.peephole_options).run(instrs);
+        }
+        Encoder encoder;
+        encoder.encode(instrs);
+        return encoder.code();
+    }
+
+    inline bool write_executable(const std::string& path) const
+    {
+        uint32_t spill_slots = 0;
+        uint64_t code_size = 0;
+        for (const Unit& unit : m_units) {
+            spill_slots = std::max(spill_slots, unit.spill_slots);
+            code_size += unit.code.size();
+        }
+        const auto last_stmt
+            = std::find_if(m_units.rbegin(), m_units.rend(), [](const Unit& unit) { return unit.has_stmt(); });
+        const bool implicit_exit = last_stmt == m_units.rend() || !last_stmt->is_exit();
+        Encoder prologue;
+        prologue.encode(
+            Generator::gen_prologue(static_cast<size_t>(m_let_slots) + spill_slots, CodegenTarget::executable));
+        code_size += prologue.code().size() + (implicit_exit ? m_exit_code.size() : 0);
+
+        OutputFile file(path, 0755);
+        const Elf64Headers headers = make_elf64_headers(code_size);
+        file.write(&headers, sizeof(headers));
+        file.write(prologue.code().data(), prologue.code().size());
+        for (const Unit& unit : m_units) {
+            file.write(unit.code.data(), unit.code.size());
+        }
+        if (implicit_exit) {
+            file.write(m_exit_code.data(), m_exit_code.size());
+        }
+        return file.close();
+    }
+};
@@ -0,0 +1,171 @@
+#include "io.hpp"
+
+#include <exception>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <utility>
+
+#include "elf.hpp"
+#include "ir.hpp"
+#include "metrics.hpp"
+#include "optimizer.hpp"
+#include "output.hpp"
+#include "parser.hpp"
+#include "thread_pool.hpp"
+#include "tokenization.hpp"
+#include "x86_64.hpp"
+
+CompileSession::CompileSession(CompileOptions options)
+    : m_options(std::move(options))
+{
+}
+
+const CompileOptions& CompileSession::options() const
+{
+    return m_options;
+}
+
+CompileResult CompileSession::compile(std::string_view source) const
+{
+    return run(source, nullptr);
+}
+
+CompileResult CompileSession::compile_to_file(std::string_view source, const std::string& path) const
+{
+    return run(source, &path);
+}
+
+CompileResult CompileSession::run(std::string_view source, const std::string* path) const
+{
+    CompileResult result;
+    CompileMetrics* metrics = m_options.collect_metrics ? &result.metrics : nullptr;
+    try {
+        // only programs big enough to split get a pool, started by the first phase that can use it
+        const size_t workers = m_options.threads == 0 ? ThreadPool::default_threads() : m_options.threads - 1;
+        std::optional<ThreadPool> pool;
+        const auto parallel = [&](bool big_enough) -> ThreadPool* {
+            if (workers == 0 || !big_enough) {
+                return nullptr;
+            }
+            if (!pool.has_value()) {
+                pool.emplace(workers);
+            }
+            return &pool.value();
+        };
+
+        TokenStream tokens;
+        {
+            const PhaseTimer timer(metrics, "lex");
+            ThreadPool* lex_pool = parallel(source.size() >= 2 * Tokenizer::PARALLEL_MIN_BYTES);
+            tokens
+                = lex_pool != nullptr ? Tokenizer(source).tokenize_parallel(*lex_pool) : Tokenizer(source).tokenize();
+        }
+        result.metrics.source_bytes = source.size();
+        result.metrics.tokens = tokens.size();
+        result.metrics.symbols = tokens.symbols.size();
+
+        Parser parser(std::move(tokens));
+        NodeProg prog;
+        {
+            const PhaseTimer timer(metrics, "parse");
+            prog = parser.parse_prog().value();
+        }
+        result.metrics.ast_nodes = prog.node_count;
+        result.metrics.statements = prog.stmts.size();
+        result.metrics.arena_bytes = parser.arena().bytes_used();
+        result.metrics.arena_high_water = parser.arena().high_water_mark();
+        result.metrics.arena_reserved = parser.arena().bytes_reserved();
+
+        std::ostringstream stats;
+        if (m_options.optimize) {
+            const PhaseTimer timer(metrics, "optimize");
+            const OptimizerStats optimizer_stats = Optimizer(prog).run();
+            if (m_options.collect_stats) {
+                optimizer_stats.print(stats);
+            }
+        }
+
+        IrProg ir;
+        {
+            const PhaseTimer timer(metrics, "lower");
+            ir = lower_to_ir(prog);
+        }
+        result.metrics.ir_instrs = ir.size();
+        if (m_options.emit_ir) {
+            const PhaseTimer timer(metrics, "print-ir");
+            std::ostringstream text;
+            ir.print(text);
+            result.ir = text.str();
+        }
+        if (m_options.emit_bytecode) {
+            const PhaseTimer timer(metrics, "bytecode");
+            result.bytecode = lower_to_bytecode(ir);
+        }
+
+        if (m_options.emit_object || m_options.emit_assembly) {
+            std::vector<Instr> instrs;
+            {
+                const PhaseTimer timer(metrics, "codegen");
+                ThreadPool* codegen_pool = parallel(ir.size() >= 2 * Generator::PARALLEL_MIN_INSTRS);
+                Generator generator(std::move(ir), m_options.codegen, m_options.target);
+                instrs = codegen_pool != nullptr ? generator.gen_prog(*codegen_pool) : generator.gen_prog();
+            }
+            if (m_options.peephole) {
+                const PhaseTimer timer(metrics, "peephole");
+                PeepholeOptimizer optimizer(m_options.peephole_options);
+                optimizer.run(instrs);
+                if (m_options.collect_stats) {
+                    optimizer.print_stats(stats);
+                }
+            }
+            result.metrics.machine_instrs = instrs.size();
+            if (m_options.emit_assembly) {
+                const PhaseTimer timer(metrics, "print-asm");
+                if (path != nullptr) {
+                    OutputFile file(*path + ".asm");
+                    write_nasm(file, instrs);
+                    if (!file.close()) {
+                        throw CompileError("Failed to write `" + *path + ".asm`");
+                    }
+                }
+                else {
+                    StringOutput text;
+                    write_nasm(text, instrs);
+                    result.assembly = text.take();
+                }
+            }
+            if (m_options.emit_object) {
+                // encoding and writing the ELF file are one streamed pass, so they're timed together
+                const PhaseTimer timer(metrics, "encode");
+                if (m_options.target == CodegenTarget::executable && path != nullptr) {
+                    if (!write_elf64_executable(*path, instrs, &result.metrics.code_bytes)) {
+                        throw CompileError("Failed to write executable `" + *path + "`");
+                    }
+                }
+                else {
+                    Encoder encoder;
+                    encoder.encode(instrs);
+                    result.metrics.code_bytes = encoder.code().size();
+                    result.object = m_options.target == CodegenTarget::executable
+                        ? make_elf64_executable(encoder.code())
+                        : encoder.code();
+                }
+            }
+        }
+        result.stats = stats.str();
+    }
+    catch (const CompileError& error) {
+        Diagnostic diagnostic { .message = error.what(), .offset = error.offset() };
+        diagnostic.locate(source);
+        result.diagnostics.push_back(std::move(diagnostic));
+    }
+    catch (const std::bad_alloc&) {
+        result.diagnostics.push_back({ .message = "Out of memory" });
+    }
+    catch (const std::exception& error) {
+        // encoder rejections and the like are compiler bugs, but still shouldn't take the host process down
+        result.diagnostics.push_back({ .message = std::string("internal compiler error: ") + error.what() });
+    }
+    return result;
+}
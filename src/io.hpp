@@ -0,0 +1,98 @@
+#pragma once
+
+// libio: the compiler as a library. A `CompileSession` takes a source buffer and returns the requested outputs plus
+// structured diagnostics; it never prints, exits or touches the file system (unless asked to stream the executable to
+// a path), so it can be embedded in a long-running process and called from many threads at once.
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "diagnostics.hpp"
+#include "generation.hpp"
+#include "metrics.hpp"
+#include "peephole.hpp"
+
+// Bump whenever the generated code can change for the same input and options; it is part of every cache key.
+constexpr std::string_view IO_VERSION = "0.1.0";
+
+struct CompileOptions {
+    CodegenMode codegen = CodegenMode::regs;
+    CodegenTarget target = CodegenTarget::executable;
+    bool optimize = true; // constant folding, propagation, dead-let elimination
+    bool peephole = true;
+    PeepholeOptions peephole_options;
+
+    bool emit_object = true; // machine code: an ELF executable for `CodegenTarget::executable`, raw code for `jit`
+    bool emit_assembly = false; // nasm syntax
+    bool emit_ir = false; // `IrProg::print` text
+    bool emit_bytecode = false; // for `Vm`
+    bool collect_stats = false; // optimizer and peephole reports
+    bool collect_metrics = false; // per-phase timings and sizes, see metrics.hpp
+    // Threads one compile may use on a large program (1: none besides the caller, 0: one per core). The output is the
+    // same for any value, so it isn't part of `compile_options_key`.
+    size_t threads = 1;
+};
+
+// Every option that affects the generated code, as text: two option sets compile the same source to the same outputs
+// iff their keys are equal. Which outputs are requested is not part of it.
+inline std::string compile_options_key(const CompileOptions& options)
+{
+    std::string key = "codegen=";
+    key += options.codegen == CodegenMode::regs ? "regs" : "stack";
+    key += ";target=";
+    key += options.target == CodegenTarget::executable ? "executable" : "jit";
+    key += ";opt=" + std::to_string(options.optimize);
+    key += ";peephole=" + std::to_string(options.peephole);
+    if (options.peephole) {
+        key += ";window=" + std::to_string(options.peephole_options.window);
+        key += ";passes=" + std::to_string(options.peephole_options.max_passes);
+        key += ";rules=";
+        for (const bool enabled : options.peephole_options.enabled) {
+            key += enabled ? '1' : '0';
+        }
+    }
+    return key;
+}
+
+struct CompileResult {
+    std::vector<Diagnostic> diagnostics;
+    std::vector<uint8_t> object;
+    std::string assembly;
+    std::string ir;
+    std::optional<Bytecode> bytecode;
+    std::string stats;
+    CompileMetrics metrics; // with `collect_metrics`
+
+    [[nodiscard]] inline bool ok() const
+    {
+        for (const Diagnostic& diagnostic : diagnostics) {
+            if (diagnostic.severity == Diagnostic::Severity::error) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+class CompileSession {
+public:
+    explicit CompileSession(CompileOptions options = {});
+
+    [[nodiscard]] const CompileOptions& options() const;
+
+    // Compile `source`. Safe to call concurrently: every call has its own tokenizer, parser arena and generator.
+    [[nodiscard]] CompileResult compile(std::string_view source) const;
+
+    // Same, but the outputs are streamed to files instead of returned: with `emit_object` an executable goes to `path`
+    // (mode 0755; JIT code is still returned in `object`), with `emit_assembly` the listing goes to `path.asm`.
+    [[nodiscard]] CompileResult compile_to_file(std::string_view source, const std::string& path) const;
+
+private:
+    CompileOptions m_options;
+
+    CompileResult run(std::string_view source, const std::string* path) const;
+};
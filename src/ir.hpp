@@ -0,0 +1,305 @@
+#pragma once
+
+// Linear three-address IR between the AST and the backends.
+//
+// A program is one flat instruction list in two parallel arrays: a one-byte `IrOp` and 8 bytes of operands. Every
+// value-producing instruction defines the virtual register with its own index (`v5` is "the result of instruction
+// 5"), so there's no separate destination array. Values never cross a statement: `let`s are stored to and loaded from
+// numbered frame slots, which `lower_to_ir` assigns (the frame layout pass).
+//
+// Expressions are lowered in Sethi-Ullman order (the operand that needs more registers first), so a backend that
+// allocates registers in instruction order keeps the fewest values alive at once.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "diagnostics.hpp"
+#include "parser.hpp"
+
+using VReg = uint32_t;
+
+enum class IrOp : uint8_t {
+    imm, // v = 64-bit immediate (`IrProg::imm_value`)
+    load, // v = slot[a]
+    store, // slot[a] = vb
+    add, // v = va + vb
+    sub, // v = va - vb
+    mul, // v = va * vb
+    div, // v = va / vb (signed, truncating)
+    exit, // exit(va)
+};
+
+struct IrArgs {
+    uint32_t a = 0;
+    uint32_t b = 0;
+};
+
+inline const char* ir_op_name(IrOp op)
+{
+    switch (op) {
+    case IrOp::imm:
+        return "imm";
+    case IrOp::load:
+        return "load";
+    case IrOp::store:
+        return "store";
+    case IrOp::add:
+        return "add";
+    case IrOp::sub:
+        return "sub";
+    case IrOp::mul:
+        return "mul";
+    case IrOp::div:
+        return "div";
+    case IrOp::exit:
+        return "exit";
+    }
+    return "?";
+}
+
+struct IrProg {
+    std::vector<IrOp> ops;
+    std::vector<IrArgs> args;
+    std::vector<uint32_t> stmt_begin; // index of the first instruction of each statement
+    uint32_t slot_count = 0; // frame slots used by `let`s
+
+    [[nodiscard]] inline size_t size() const
+    {
+        return ops.size();
+    }
+
+    [[nodiscard]] inline static bool is_bin_op(IrOp op)
+    {
+        return op == IrOp::add || op == IrOp::sub || op == IrOp::mul || op == IrOp::div;
+    }
+
+    [[nodiscard]] inline static bool defines_value(IrOp op)
+    {
+        return op != IrOp::store && op != IrOp::exit;
+    }
+
+    [[nodiscard]] inline int64_t imm_value(size_t i) const
+    {
+        return static_cast<int64_t>(static_cast<uint64_t>(args[i].a) | static_cast<uint64_t>(args[i].b) << 32);
+    }
+
+    // Start a statement at the next instruction. Code is generated by statement (see `Generator::gen_prog`), so every
+    // instruction must belong to one.
+    inline void begin_stmt()
+    {
+        stmt_begin.push_back(static_cast<uint32_t>(size()));
+    }
+
+    inline VReg push(IrOp op, IrArgs operands)
+    {
+        ops.push_back(op);
+        args.push_back(operands);
+        return static_cast<VReg>(ops.size() - 1);
+    }
+
+    inline VReg push_imm(int64_t value)
+    {
+        const auto bits = static_cast<uint64_t>(value);
+        return push(IrOp::imm, { .a = static_cast<uint32_t>(bits), .b = static_cast<uint32_t>(bits >> 32) });
+    }
+
+    inline void print(std::ostream& out) const
+    {
+        out << "; " << slot_count << " slot(s)\n";
+        for (size_t i = 0; i < size(); i++) {
+            const IrArgs& arg = args[i];
+            switch (ops[i]) {
+            case IrOp::imm:
+                out << "    v" << i << " = imm " << imm_value(i) << "\n";
+                break;
+            case IrOp::load:
+                out << "    v" << i << " = load s" << arg.a << "\n";
+                break;
+            case IrOp::store:
+                out << "    store s" << arg.a << ", v" << arg.b << "\n";
+                break;
+            case IrOp::exit:
+                out << "    exit v" << arg.a << "\n";
+                break;
+            default:
+                out << "    v" << i << " = " << ir_op_name(ops[i]) << " v" << arg.a << ", v" << arg.b << "\n";
+                break;
+            }
+        }
+    }
+};
+
+/**
+ * Lower a `NodeProg` to IR. Also the frame layout pass: every `let` gets the next slot in declaration order and
+ * every identifier use is resolved to the slot of an earlier `let` (`let x = x;` is undeclared).
+ *
+ * Ends with an explicit `exit(0)` unless the program already ends in `exit`.
+ */
+class IrLowering {
+public:
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    inline explicit IrLowering(const NodeProg& prog)
+        : m_prog(prog)
+    {
+    }
+
+    // Lower a part of a program on its own (`IncrementalCompiler`): `slots` binds the names declared before it, by
+    // symbol id (`NO_SLOT` if not declared), its first `let` gets slot `first_slot`, and no `exit(0)` is appended.
+    inline IrLowering(const NodeProg& prog, std::vector<uint32_t> slots, uint32_t first_slot)
+        : m_prog(prog)
+        , m_slots(std::move(slots))
+        , m_next_slot(first_slot)
+        , m_partial(true)
+    {
+    }
+
+    inline IrProg lower()
+    {
+        m_ir.ops.reserve(m_prog.node_count + 2);
+        m_ir.args.reserve(m_prog.node_count + 2);
+        m_ir.stmt_begin.reserve(m_prog.stmts.size() + 1);
+        m_slots.resize(m_prog.symbol_count(), NO_SLOT);
+        for (const NodeId stmt : m_prog.stmts) {
+            m_ir.begin_stmt();
+            switch (m_prog.kind(stmt)) {
+            case NodeKind::stmt_exit:
+                m_ir.push(IrOp::exit, { .a = lower_expr(m_prog.lhs(stmt)) });
+                break;
+            case NodeKind::stmt_let: {
+                const VReg value = lower_expr(m_prog.rhs(stmt));
+                const NodeId ident = m_prog.lhs(stmt);
+                uint32_t& slot = m_slots[m_prog.symbol(ident)];
+                if (slot != NO_SLOT) {
+                    throw CompileError("Identifier already used: " + std::string(m_prog.ident(ident)),
+                                       m_prog.lhs(ident));
+                }
+                slot = m_next_slot++;
+                m_ir.push(IrOp::store, { .a = slot, .b = value });
+                break;
+            }
+            default:
+                throw CompileError("Invalid statement");
+            }
+        }
+        if (!m_partial && (m_prog.stmts.empty() || m_prog.kind(m_prog.stmts.back()) != NodeKind::stmt_exit)) {
+            m_ir.begin_stmt();
+            m_ir.push(IrOp::exit, { .a = m_ir.push_imm(0) });
+        }
+        m_ir.slot_count = m_next_slot;
+        return std::move(m_ir);
+    }
+
+private:
+    // explicit call stack for `lower_expr`
+    struct Frame {
+        NodeId id;
+        uint8_t state = 0; // 0: enter, 1: first operand lowered, 2: both lowered
+        bool lhs_first = true;
+    };
+
+    const NodeProg& m_prog;
+    IrProg m_ir;
+    std::vector<uint32_t> m_slots; // by symbol id
+    uint32_t m_next_slot = 0;
+    bool m_partial = false;
+    std::vector<uint8_t> m_need; // per node of the current expression, indexed by id - first
+    std::vector<VReg> m_vreg; // same indexing
+    std::vector<Frame> m_frames;
+
+    inline uint32_t slot_of(NodeId ident)
+    {
+        const uint32_t slot = m_slots[m_prog.symbol(ident)];
+        if (slot == NO_SLOT) {
+            throw CompileError("Undeclared identifier: " + std::string(m_prog.ident(ident)), m_prog.lhs(ident));
+        }
+        return slot;
+    }
+
+    static inline IrOp bin_op(NodeKind kind)
+    {
+        switch (kind) {
+        case NodeKind::bin_sub:
+            return IrOp::sub;
+        case NodeKind::bin_mul:
+            return IrOp::mul;
+        case NodeKind::bin_div:
+            return IrOp::div;
+        default:
+            return IrOp::add;
+        }
+    }
+
+    /**
+     * Sethi-Ullman: label every node with the registers it needs (leaf 1, binary node max(l, r), or l + 1 when both
+     * sides need the same), in one pass over the post-order id range, then emit the hungrier operand first. The walk
+     * uses an explicit stack: left-deep chains are as deep as they are long.
+     *
+     * Identifiers are resolved in the labelling pass, which sees them in source order, so the undeclared name reported
+     * is the leftmost one and not whichever the walk happens to reach first.
+     */
+    inline VReg lower_expr(NodeId root)
+    {
+        const NodeId first = m_prog.first_node(root);
+        m_need.resize(root - first + 1);
+        m_vreg.resize(root - first + 1);
+        for (NodeId id = first; id <= root; id++) {
+            uint8_t need = 1;
+            if (m_prog.kind(id) == NodeKind::ident) {
+                slot_of(id);
+            }
+            else if (NodeProg::is_bin_expr(m_prog.kind(id))) {
+                const uint8_t l = m_need[m_prog.lhs(id) - first];
+                const uint8_t r = m_need[m_prog.rhs(id) - first];
+                need = l == r ? l + 1 : std::max(l, r);
+            }
+            m_need[id - first] = need;
+        }
+
+        m_frames.clear();
+        m_frames.push_back({ .id = root });
+        while (!m_frames.empty()) {
+            Frame& frame = m_frames.back();
+            const NodeId id = frame.id;
+            const NodeKind kind = m_prog.kind(id);
+            if (kind == NodeKind::int_lit) {
+                m_vreg[id - first] = m_ir.push_imm(m_prog.int_value(id));
+                m_frames.pop_back();
+                continue;
+            }
+            if (kind == NodeKind::ident) {
+                m_vreg[id - first] = m_ir.push(IrOp::load, { .a = m_slots[m_prog.symbol(id)] });
+                m_frames.pop_back();
+                continue;
+            }
+            switch (frame.state) {
+            case 0:
+                frame.lhs_first = m_need[m_prog.lhs(id) - first] >= m_need[m_prog.rhs(id) - first];
+                frame.state = 1;
+                m_frames.push_back({ .id = frame.lhs_first ? m_prog.lhs(id) : m_prog.rhs(id) });
+                break;
+            case 1:
+                frame.state = 2;
+                m_frames.push_back({ .id = frame.lhs_first ? m_prog.rhs(id) : m_prog.lhs(id) });
+                break;
+            default:
+                m_vreg[id - first] = m_ir.push(
+                    bin_op(kind), { .a = m_vreg[m_prog.lhs(id) - first], .b = m_vreg[m_prog.rhs(id) - first] });
+                m_frames.pop_back();
+                break;
+            }
+        }
+        return m_vreg[root - first];
+    }
+};
+
+inline IrProg lower_to_ir(const NodeProg& prog)
+{
+    return IrLowering(prog).lower();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+// In-process execution for `--jit`: the program is generated with `CodegenTarget::jit` (its `exit` returns the status
+// instead of making the exit syscall), encoded into an anonymous mapping that is flipped from read-write to
+// read-execute before it runs, and called like a function. No file is written and no process is started.
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+class JitCode {
+public:
+    // Copies `code` into a fresh mapping and makes it executable; check `ok()`.
+    inline explicit JitCode(const std::vector<uint8_t>& code)
+    {
+        // an empty mapping is invalid, and there is always at least a `ret`
+        m_size = code.empty() ? 1 : code.size();
+        void* addr = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            return;
+        }
+        m_addr = addr;
+        std::memcpy(m_addr, code.data(), code.size());
+        // W^X: never writable and executable at the same time
+        m_ok = mprotect(m_addr, m_size, PROT_READ | PROT_EXEC) == 0;
+    }
+
+    // make it non-copyable
+    inline JitCode(const JitCode& other) = delete;
+
+    inline JitCode operator=(const JitCode& other) = delete;
+
+    inline ~JitCode()
+    {
+        if (m_addr != nullptr) {
+            munmap(m_addr, m_size);
+        }
+    }
+
+    [[nodiscard]] inline bool ok() const
+    {
+        return m_ok;
+    }
+
+    // Run the program; returns the value it passed to `exit`.
+    inline int64_t run() const
+    {
+        using Entry = int64_t (*)();
+        return reinterpret_cast<Entry>(m_addr)();
+    }
+
+private:
+    void* m_addr = nullptr;
+    size_t m_size = 0;
+    bool m_ok = false;
+};
+
+// Run machine code generated for `CodegenTarget::jit`. Returns its exit status (the low 8 bits of the value, as the
+// kernel would report it), or nothing if the code couldn't be mapped.
+inline std::optional<int> run_jit(const std::vector<uint8_t>& machine_code)
+{
+    const JitCode code(machine_code);
+    if (!code.ok()) {
+        return {};
+    }
+    return static_cast<int>(static_cast<uint64_t>(code.run()) & 0xFF);
+}
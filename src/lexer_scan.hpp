@@ -0,0 +1,191 @@
+#pragma once
+
+// Run scanners for the tokenizer: given `p < end`, return the first byte at or after `p` that is NOT part of the run
+// (whitespace, identifier characters, digits). The SSE2/AVX2 variants classify 16/32 bytes per iteration and finish the
+// tail with the scalar loop. The variant is picked once at runtime from CPUID (`detect_lexer_isa`).
+//
+// Classes match the "C" locale `isspace`/`isalnum`/`isdigit` the tokenizer used before, so output is unchanged.
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define IO_LEXER_X86 1
+#include <immintrin.h>
+#endif
+
+enum class LexerIsa : uint8_t { scalar, sse2, avx2 };
+
+inline const char* lexer_isa_name(LexerIsa isa)
+{
+    switch (isa) {
+    case LexerIsa::scalar:
+        return "scalar";
+    case LexerIsa::sse2:
+        return "sse2";
+    case LexerIsa::avx2:
+        return "avx2";
+    }
+    return "?";
+}
+
+constexpr bool is_space_byte(uint8_t c)
+{
+    return c == ' ' || static_cast<uint8_t>(c - '\t') < 5; // \t \n \v \f \r
+}
+
+constexpr bool is_digit_byte(uint8_t c)
+{
+    return static_cast<uint8_t>(c - '0') < 10;
+}
+
+constexpr bool is_alpha_byte(uint8_t c)
+{
+    return static_cast<uint8_t>((c | 0x20) - 'a') < 26;
+}
+
+constexpr bool is_alnum_byte(uint8_t c)
+{
+    return is_alpha_byte(c) || is_digit_byte(c);
+}
+
+template <bool (*pred)(uint8_t)>
+inline const char* scan_scalar(const char* p, const char* end)
+{
+    while (p < end && pred(static_cast<uint8_t>(*p))) {
+        p++;
+    }
+    return p;
+}
+
+#ifdef IO_LEXER_X86
+
+// Byte-wise `lo <= c <= hi` with signed compares only: shift the range so it starts at INT8_MIN.
+inline __m128i sse2_in_range(__m128i v, char lo, char hi)
+{
+    const __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(-128 - lo)));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + (hi - lo) + 1)));
+}
+
+inline __m128i sse2_space(__m128i v)
+{
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), sse2_in_range(v, '\t', '\r'));
+}
+
+inline __m128i sse2_digit(__m128i v)
+{
+    return sse2_in_range(v, '0', '9');
+}
+
+inline __m128i sse2_alnum(__m128i v)
+{
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_or_si128(sse2_in_range(lower, 'a', 'z'), sse2_digit(v));
+}
+
+template <__m128i (*classify)(__m128i), bool (*pred)(uint8_t)>
+inline const char* scan_sse2(const char* p, const char* end)
+{
+    while (end - p >= 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const auto miss = static_cast<uint32_t>(~_mm_movemask_epi8(classify(v)) & 0xFFFF);
+        if (miss != 0) {
+            return p + __builtin_ctz(miss);
+        }
+        p += 16;
+    }
+    return scan_scalar<pred>(p, end);
+}
+
+#define IO_AVX2 __attribute__((target("avx2")))
+
+IO_AVX2 inline __m256i avx2_in_range(__m256i v, char lo, char hi)
+{
+    const __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8(static_cast<char>(-128 - lo)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + (hi - lo) + 1)), shifted);
+}
+
+IO_AVX2 inline __m256i avx2_space(__m256i v)
+{
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), avx2_in_range(v, '\t', '\r'));
+}
+
+IO_AVX2 inline __m256i avx2_digit(__m256i v)
+{
+    return avx2_in_range(v, '0', '9');
+}
+
+IO_AVX2 inline __m256i avx2_alnum(__m256i v)
+{
+    const __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(avx2_in_range(lower, 'a', 'z'), avx2_digit(v));
+}
+
+template <__m256i (*classify)(__m256i), __m128i (*classify128)(__m128i), bool (*pred)(uint8_t)>
+IO_AVX2 inline const char* scan_avx2(const char* p, const char* end)
+{
+    while (end - p >= 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const auto miss = ~static_cast<uint32_t>(_mm256_movemask_epi8(classify(v)));
+        if (miss != 0) {
+            return p + __builtin_ctz(miss);
+        }
+        p += 32;
+    }
+    return scan_sse2<classify128, pred>(p, end);
+}
+
+#undef IO_AVX2
+
+#endif // IO_LEXER_X86
+
+struct LexerScanners {
+    const char* (*skip_space)(const char* p, const char* end);
+    const char* (*skip_alnum)(const char* p, const char* end);
+    const char* (*skip_digits)(const char* p, const char* end);
+};
+
+inline LexerIsa detect_lexer_isa()
+{
+#ifdef IO_LEXER_X86
+    static const LexerIsa isa = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return LexerIsa::avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return LexerIsa::sse2;
+        }
+        return LexerIsa::scalar;
+    }();
+    return isa;
+#else
+    return LexerIsa::scalar;
+#endif
+}
+
+// Falls back to the best supported variant if `isa` isn't available on this build.
+inline LexerScanners lexer_scanners(LexerIsa isa)
+{
+#ifdef IO_LEXER_X86
+    if (isa == LexerIsa::avx2) {
+        return {
+            .skip_space = scan_avx2<avx2_space, sse2_space, is_space_byte>,
+            .skip_alnum = scan_avx2<avx2_alnum, sse2_alnum, is_alnum_byte>,
+            .skip_digits = scan_avx2<avx2_digit, sse2_digit, is_digit_byte>,
+        };
+    }
+    if (isa == LexerIsa::sse2) {
+        return {
+            .skip_space = scan_sse2<sse2_space, is_space_byte>,
+            .skip_alnum = scan_sse2<sse2_alnum, is_alnum_byte>,
+            .skip_digits = scan_sse2<sse2_digit, is_digit_byte>,
+        };
+    }
+#endif
+    (void)isa;
+    return {
+        .skip_space = scan_scalar<is_space_byte>,
+        .skip_alnum = scan_scalar<is_alnum_byte>,
+        .skip_digits = scan_scalar<is_digit_byte>,
+    };
+}
@@ -1,50 +1,659 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <optional>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
-#include "arena.hpp"
-#include "generation.hpp"
+#include "bytecode.hpp"
+#include "cache.hpp"
+#include "incremental.hpp"
+#include "io.hpp"
+#include "jit.hpp"
+#include "metrics.hpp"
+#include "output.hpp"
+#include "source.hpp"
+#include "thread_pool.hpp"
+#include "vm.hpp"
+#include "watch.hpp"
 
-int main(int argc, char* argv[])
+static void usage()
+{
+    std::cerr << "Incorrect usage: Correct usage is..." << std::endl;
+    std::cerr << "io [options] <input.io>" << std::endl;
+    std::cerr << "io [options] -j N <a.io> <b.io> ... | @<response-file>" << std::endl;
+    std::cerr << "    --emit-asm              also write the generated assembly to `out.asm` (debug output)"
+              << std::endl;
+    std::cerr << "    --emit-ir               also write the lowered IR to `out.ir` (debug output)" << std::endl;
+    std::cerr << "    --jit                   run the program in-process and exit with its status, no `out` is written"
+              << std::endl;
+    std::cerr << "    --vm                    interpret the program as bytecode and exit with its status" << std::endl;
+    std::cerr << "    --emit-bytecode         also write the bytecode to `out.iobc`" << std::endl;
+    std::cerr << "    --run-bytecode          the input is an `.iobc` file from --emit-bytecode, interpret it"
+              << std::endl;
+    std::cerr << "    --codegen=regs|stack    keep temporaries in registers (default) or on the stack" << std::endl;
+    std::cerr << "    --no-opt                skip constant folding and dead-let elimination" << std::endl;
+    std::cerr << "    --pass-stats            print what each optimizer pass did" << std::endl;
+    std::cerr << "    --no-peephole           skip the peephole optimizer" << std::endl;
+    std::cerr << "    --peephole-window=N     instructions a peephole rule may look at (default 3)" << std::endl;
+    std::cerr << "    --peephole-rules=A,B    run only these peephole rules: push-pop, push-pop-around, copy-prop,"
+              << std::endl;
+    std::cerr << "                            imm-operand, dead-mov" << std::endl;
+    std::cerr << "    --no-peephole-rule=A    skip one peephole rule" << std::endl;
+    std::cerr << "    --peephole-stats        print how many instructions each peephole rule removed" << std::endl;
+    std::cerr << "    --time-passes           print the wall and CPU time and heap allocations of each phase"
+              << std::endl;
+    std::cerr << "    --stats                 print token, node and instruction counts and memory use" << std::endl;
+    std::cerr << "    --stats-json            print both as one JSON object per input on stdout" << std::endl;
+    std::cerr << "    -j N                    compile several inputs on N threads (0: one per core); each `a.io` is"
+              << std::endl;
+    std::cerr << "                            written to `a`, `a.asm`, ... instead of `out`; `@file` reads one input"
+              << std::endl;
+    std::cerr << "                            path per line" << std::endl;
+    std::cerr << "    --threads=N             threads for lexing one large input (0: one per core, the default;"
+              << std::endl;
+    std::cerr << "                            1 with -j)" << std::endl;
+    std::cerr << "    --watch                 rebuild `out` whenever the input changes, redoing only what the edit"
+              << std::endl;
+    std::cerr << "                            touched" << std::endl;
+    std::cerr << "    --cache                 reuse outputs of identical earlier compiles from the cache directory"
+              << std::endl;
+    std::cerr << "                            ($IO_CACHE_DIR, else $XDG_CACHE_HOME/io or ~/.cache/io)" << std::endl;
+    std::cerr << "    --cache-dir=DIR         like --cache, with the cache in DIR" << std::endl;
+    std::cerr << "    --cache-stats           print the cache's hit/miss counters and size" << std::endl;
+    std::cerr << "    --cache-prune=SIZE      evict least recently used entries until the cache fits SIZE (K, M, G)"
+              << std::endl;
+}
+
+struct DriverOptions {
+    CompileOptions compile;
+    bool emit_asm = false;
+    bool emit_ir = false;
+    bool jit = false;
+    bool vm = false;
+    bool emit_bytecode = false;
+    bool run_bytecode = false;
+    bool stats = false; // --pass-stats / --peephole-stats
+    bool time_passes = false;
+    bool counter_stats = false; // --stats
+    bool stats_json = false;
+    bool watch = false;
+    CompileCache* cache = nullptr; // --cache
+    std::string compiler_id; // part of every cache key
+};
+
+// Identifies this build of `io`, so a rebuilt compiler never reuses the old one's cache entries.
+static std::string compiler_identity()
+{
+    std::string id(IO_VERSION);
+    std::error_code ec;
+    const std::filesystem::path exe = std::filesystem::read_symlink("/proc/self/exe", ec);
+    if (!ec) {
+        const uintmax_t size = std::filesystem::file_size(exe, ec);
+        const auto mtime = std::filesystem::last_write_time(exe, ec);
+        id += ";" + exe.string() + ";" + std::to_string(size) + ";"
+            + std::to_string(mtime.time_since_epoch().count());
+    }
+    return id;
+}
+
+static std::filesystem::path default_cache_dir()
+{
+    if (const char* dir = std::getenv("IO_CACHE_DIR"); dir != nullptr && *dir != '\0') {
+        return dir;
+    }
+    if (const char* dir = std::getenv("XDG_CACHE_HOME"); dir != nullptr && *dir != '\0') {
+        return std::filesystem::path(dir) / "io";
+    }
+    const char* home = std::getenv("HOME");
+    return std::filesystem::path(home != nullptr ? home : ".") / ".cache" / "io";
+}
+
+// `123`, `64K`, `100M`, `2G`.
+static std::optional<uint64_t> parse_size(const char* text)
+{
+    char* end = nullptr;
+    uint64_t size = std::strtoull(text, &end, 10);
+    if (end == text) {
+        return {};
+    }
+    switch (*end) {
+    case '\0':
+        return size;
+    case 'K':
+    case 'k':
+        size <<= 10;
+        break;
+    case 'M':
+    case 'm':
+        size <<= 20;
+        break;
+    case 'G':
+    case 'g':
+        size <<= 30;
+        break;
+    default:
+        return {};
+    }
+    return end[1] == '\0' ? std::optional(size) : std::nullopt;
+}
+
+// A count that must be at least 1: digits only, no sign or suffix.
+static std::optional<size_t> parse_positive(const char* text)
+{
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long value = std::strtoull(text, &end, 10);
+    if (!std::isdigit(static_cast<unsigned char>(*text)) || *end != '\0' || value == 0 || errno == ERANGE) {
+        return {};
+    }
+    return static_cast<size_t>(value);
+}
+
+// `push-pop,copy-prop`: the rules to run, all others are disabled.
+static std::optional<std::array<bool, static_cast<size_t>(PeepholeRule::count)>> parse_peephole_rules(const char* text)
+{
+    std::array<bool, static_cast<size_t>(PeepholeRule::count)> enabled {};
+    std::string_view rest = text;
+    while (!rest.empty()) {
+        const size_t comma = std::min(rest.find(','), rest.size());
+        const std::optional<PeepholeRule> rule = peephole_rule_from_name(rest.substr(0, comma));
+        if (!rule.has_value()) {
+            return {};
+        }
+        enabled[static_cast<size_t>(*rule)] = true;
+        rest.remove_prefix(std::min(comma + 1, rest.size()));
+    }
+    return enabled;
+}
+
+// Exit status of the interpreted program, 128 + SIGFPE (what the shell reports for the native one) on a trap.
+static int run_vm(const Bytecode& bc)
+{
+    const VmResult result = Vm(bc).run();
+    if (result.trapped) {
+        std::cerr << "Floating point exception" << std::endl;
+        return 128 + SIGFPE;
+    }
+    return static_cast<int>(static_cast<uint64_t>(result.value) & 0xFF);
+}
+
+static bool write_text_file(const std::string& path, std::string_view text)
+{
+    OutputFile file(path);
+    file.write(text);
+    if (!file.close()) {
+        std::cerr << "Failed to write `" << path << "`" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void report_metrics(const DriverOptions& options, const std::string& input_path, CompileMetrics& metrics)
+{
+    rusage usage {};
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        metrics.max_rss_bytes = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+    }
+    // one write per stream, so reports of units compiled side by side don't interleave
+    std::ostringstream text;
+    if (options.time_passes) {
+        metrics.print_time_passes(text, input_path);
+    }
+    if (options.counter_stats) {
+        metrics.print_stats(text, input_path);
+    }
+    std::cerr << text.str() << std::flush;
+    if (options.stats_json) {
+        std::ostringstream json;
+        metrics.write_json(json, input_path);
+        json << "\n";
+        std::cout << json.str() << std::flush;
+    }
+}
+
+/**
+ * Compile one input with libio and write or run what it returns. Outputs are named after `out_base`: the executable
+ * is `out_base` itself, the debug outputs get `.asm`, `.ir` and `.iobc` appended. Nothing here is shared between
+ * calls, so units can be compiled on several threads at once.
+ *
+ * Returns the process exit status: the program's own for `--jit`/`--vm`, otherwise success or failure.
+ */
+static int compile_unit(const DriverOptions& options, const std::string& input_path, const std::string& out_base,
+                        size_t* source_bytes = nullptr)
 {
-    if (argc != 2) {
-        std::cerr << "Incorrect usage: Correct usage is..." << std::endl;
-        std::cerr << "io <input.io>" << std::endl;
+    // what `--time-passes`, `--stats` and `--stats-json` report, the driver's own phases included
+    const bool measure = options.time_passes || options.counter_stats || options.stats_json;
+    CompileMetrics metrics;
+    const SourceFile source = [&] {
+        const PhaseTimer timer(measure ? &metrics : nullptr, "read");
+        return SourceFile(input_path);
+    }();
+    if (!source.ok()) {
+        std::cerr << "Failed to read `" << input_path << "`" << std::endl;
         return EXIT_FAILURE;
     }
+    if (source_bytes != nullptr) {
+        *source_bytes = source.view().size();
+    }
 
-    std::string contents;
-    {
-        std::stringstream contents_stream;
-        std::fstream input(argv[1], std::ios::in);
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
+    if (options.run_bytecode) {
+        const std::optional<Bytecode> bc = read_bytecode(source.view());
+        if (!bc.has_value()) {
+            std::cerr << "Invalid bytecode file `" << input_path << "`" << std::endl;
+            return EXIT_FAILURE;
+        }
+        return run_vm(bc.value());
     }
 
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize(); // tokenize(contents);
+    CompileOptions compile = options.compile;
+    compile.target = options.jit ? CodegenTarget::jit : CodegenTarget::executable;
+    compile.emit_object = !options.vm;
+    compile.emit_assembly = options.emit_asm && !options.vm;
+    compile.emit_ir = options.emit_ir;
+    compile.emit_bytecode = options.vm || options.emit_bytecode;
+    compile.collect_stats = options.stats;
+    compile.collect_metrics = measure;
 
-    Parser parser(std::move(tokens));
-    std::optional<NodeProg> prog = parser.parse_prog();
-    if (!prog.has_value()) {
-        std::cerr << "Invalid program" << std::endl;
-        exit(EXIT_FAILURE);
+    // Only file outputs are cached; `--jit` and `--vm` run the program, which is what they are for.
+    const bool cached = options.cache != nullptr && !options.jit && !options.vm;
+    std::string cache_key;
+    std::vector<std::pair<CacheArtifact, std::string>> artifacts;
+    if (cached) {
+        cache_key = CompileCache::key(options.compiler_id, compile_options_key(compile), source.view());
+        artifacts.emplace_back(CacheArtifact::executable, out_base);
+        if (compile.emit_assembly) {
+            artifacts.emplace_back(CacheArtifact::assembly, out_base + ".asm");
+        }
+        if (compile.emit_ir) {
+            artifacts.emplace_back(CacheArtifact::ir, out_base + ".ir");
+        }
+        if (compile.emit_bytecode) {
+            artifacts.emplace_back(CacheArtifact::bytecode, out_base + ".iobc");
+        }
+        // a hit has no pass statistics or timings to print, so asking for them forces a compile
+        if (!options.stats && !measure && options.cache->fetch(cache_key, artifacts)) {
+            return EXIT_SUCCESS;
+        }
     }
 
-    Generator generator(prog.value());
-    {
-        std::fstream file("out.asm", std::ios::out);
-        file << generator.gen_prog(); // tokens_to_asm(tokens);
+    const CompileSession session(compile);
+    // Assembled and linked in-process instead of `nasm -felf64 out.asm && ld -o out out.o`; `out` and `out.asm` are
+    // streamed to their files (JIT code comes back in memory).
+    const CompileResult result
+        = options.vm ? session.compile(source.view()) : session.compile_to_file(source.view(), out_base);
+    for (const Diagnostic& diagnostic : result.diagnostics) {
+        std::cerr << diagnostic.format(input_path) << std::endl;
+    }
+    if (!result.stats.empty()) {
+        std::cerr << result.stats;
+    }
+    if (!result.ok()) {
+        return EXIT_FAILURE;
     }
 
-    system("nasm -felf64 out.asm");
-    system("ld -o out out.o");
+    const CompileMetrics& compiled = result.metrics;
+    metrics.phases.insert(metrics.phases.end(), compiled.phases.begin(), compiled.phases.end());
+    if (compile.emit_ir || options.emit_bytecode || cached) {
+        const PhaseTimer timer(measure ? &metrics : nullptr, "write");
+        if (compile.emit_ir && !write_text_file(out_base + ".ir", result.ir)) {
+            return EXIT_FAILURE;
+        }
+        if (options.emit_bytecode && !write_bytecode(out_base + ".iobc", result.bytecode.value())) {
+            std::cerr << "Failed to write `" << out_base << ".iobc`" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (cached) {
+            // best effort: a failed store only costs a compile next time
+            for (const auto& [artifact, path] : artifacts) {
+                options.cache->store(cache_key, artifact, path);
+            }
+        }
+    }
+    if (measure) {
+        std::vector<PhaseTime> phases = std::move(metrics.phases);
+        metrics = compiled;
+        metrics.phases = std::move(phases);
+        report_metrics(options, input_path, metrics);
+    }
 
+    if (options.vm) {
+        return run_vm(result.bytecode.value());
+    }
+    if (options.jit) {
+        const std::optional<int> status = run_jit(result.object);
+        if (!status.has_value()) {
+            std::cerr << "Failed to map JIT code" << std::endl;
+            return EXIT_FAILURE;
+        }
+        return status.value();
+    }
     return EXIT_SUCCESS;
 }
 
+/**
+ * `--watch`: build `out`, then rebuild it every time the input is saved until interrupted. `IncrementalCompiler`
+ * keeps the previous build, so only the statements an edit touched are lexed, parsed and generated again.
+ */
+static int watch(const DriverOptions& options, const std::string& input_path)
+{
+    FileWatcher watcher(input_path);
+    if (!watcher.ok()) {
+        std::cerr << "Failed to watch `" << input_path << "`" << std::endl;
+        return EXIT_FAILURE;
+    }
+    IncrementalCompiler compiler(options.compile);
+    do {
+        const auto start = std::chrono::steady_clock::now();
+        std::string text;
+        {
+            const SourceFile source(input_path);
+            if (!source.ok()) {
+                std::cerr << "Failed to read `" << input_path << "`" << std::endl;
+                continue;
+            }
+            text = source.view();
+        }
+        const CompileResult result = compiler.update(std::move(text), "out");
+        for (const Diagnostic& diagnostic : result.diagnostics) {
+            std::cerr << diagnostic.format(input_path) << std::endl;
+        }
+        if (result.ok()) {
+            const IncrementalCompiler::Stats& stats = compiler.stats();
+            const double ms
+                = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cerr << "watch: `out` rebuilt in " << ms << " ms (relexed " << stats.relexed_bytes
+                      << " byte(s), reparsed " << stats.reparsed_stmts << " and regenerated "
+                      << stats.regenerated_stmts << " of " << stats.stmts << " statement(s))" << std::endl;
+        }
+    } while (watcher.wait());
+    std::cerr << "Failed to watch `" << input_path << "`" << std::endl;
+    return EXIT_FAILURE;
+}
+
+// `dir/a.io` -> `dir/a`; anything without the `.io` extension gets `.out` appended instead.
+static std::string batch_output_base(const std::string& input_path)
+{
+    constexpr std::string_view ext = ".io";
+    if (input_path.size() > ext.size() && input_path.ends_with(ext)) {
+        return input_path.substr(0, input_path.size() - ext.size());
+    }
+    return input_path + ".out";
+}
+
+// One input path per non-empty line.
+static bool read_response_file(const char* path, std::vector<std::string>& inputs)
+{
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            inputs.push_back(line);
+        }
+    }
+    return true;
+}
+
+/**
+ * Compile every input on a work-stealing pool of `jobs` threads, each to its own output path, and report aggregate
+ * throughput on stderr. Units are submitted largest first, and the pool starts work from outside it in submission
+ * order, so a big file doesn't start last and hold up the batch.
+ */
+static int compile_batch(const DriverOptions& options, const std::vector<std::string>& inputs, size_t jobs)
+{
+    std::vector<size_t> order(inputs.size());
+    std::vector<uintmax_t> sizes(inputs.size(), 0);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        order[i] = i;
+        std::error_code ec;
+        sizes[i] = std::filesystem::file_size(inputs[i], ec);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+    std::atomic<size_t> failed = 0;
+    std::atomic<size_t> total_bytes = 0;
+    const auto start = std::chrono::steady_clock::now();
+    size_t threads = 0;
+    size_t steals = 0;
+    {
+        // the caller runs tasks too, so N jobs is N - 1 workers
+        ThreadPool pool(jobs == 0 ? ThreadPool::default_threads() : jobs - 1);
+        for (const size_t i : order) {
+            pool.submit([&, i] {
+                size_t bytes = 0;
+                if (compile_unit(options, inputs[i], batch_output_base(inputs[i]), &bytes) != EXIT_SUCCESS) {
+                    failed.fetch_add(1, std::memory_order_relaxed);
+                }
+                total_bytes.fetch_add(bytes, std::memory_order_relaxed);
+            });
+        }
+        pool.wait();
+        threads = pool.size();
+        steals = pool.steals();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << "compiled " << inputs.size() - failed << "/" << inputs.size() << " unit(s) on " << threads
+              << " thread(s) in " << seconds * 1000.0 << " ms: " << static_cast<double>(inputs.size()) / seconds
+              << " units/s, " << static_cast<double>(total_bytes) / seconds / (1024.0 * 1024.0) << " MiB/s ("
+              << steals << " stolen)" << std::endl;
+    if (options.cache != nullptr) {
+        std::cerr << "cache: " << options.cache->hits() << " hit(s), " << options.cache->misses() << " miss(es)"
+                  << std::endl;
+    }
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[])
+{
+    DriverOptions options;
+    std::vector<std::string> inputs;
+    std::optional<size_t> jobs;
+    std::optional<size_t> threads;
+    bool batch = false;
+    std::optional<std::filesystem::path> cache_dir;
+    bool cache_stats = false;
+    std::optional<uint64_t> cache_prune;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--emit-asm") == 0) {
+            options.emit_asm = true;
+        }
+        else if (std::strcmp(argv[i], "--emit-ir") == 0) {
+            options.emit_ir = true;
+        }
+        else if (std::strcmp(argv[i], "--jit") == 0) {
+            options.jit = true;
+        }
+        else if (std::strcmp(argv[i], "--vm") == 0) {
+            options.vm = true;
+        }
+        else if (std::strcmp(argv[i], "--emit-bytecode") == 0) {
+            options.emit_bytecode = true;
+        }
+        else if (std::strcmp(argv[i], "--run-bytecode") == 0) {
+            options.run_bytecode = true;
+        }
+        else if (std::strcmp(argv[i], "--codegen=regs") == 0) {
+            options.compile.codegen = CodegenMode::regs;
+        }
+        else if (std::strcmp(argv[i], "--codegen=stack") == 0) {
+            options.compile.codegen = CodegenMode::stack;
+        }
+        else if (std::strcmp(argv[i], "--no-opt") == 0) {
+            options.compile.optimize = false;
+        }
+        else if (std::strcmp(argv[i], "--pass-stats") == 0) {
+            options.stats = true;
+        }
+        else if (std::strcmp(argv[i], "--no-peephole") == 0) {
+            options.compile.peephole = false;
+        }
+        else if (std::strncmp(argv[i], "--peephole-window=", 18) == 0) {
+            const std::optional<size_t> window = parse_positive(argv[i] + 18);
+            if (!window.has_value()) {
+                std::cerr << "Invalid peephole window `" << argv[i] + 18 << "`, expected a positive integer"
+                          << std::endl;
+                return EXIT_FAILURE;
+            }
+            options.compile.peephole_options.window = *window;
+        }
+        else if (std::strncmp(argv[i], "--peephole-rules=", 17) == 0) {
+            const auto enabled = parse_peephole_rules(argv[i] + 17);
+            if (!enabled.has_value()) {
+                std::cerr << "Invalid peephole rule list `" << argv[i] + 17 << "`" << std::endl;
+                return EXIT_FAILURE;
+            }
+            options.compile.peephole_options.enabled = *enabled;
+        }
+        else if (std::strncmp(argv[i], "--no-peephole-rule=", 19) == 0) {
+            const std::optional<PeepholeRule> rule = peephole_rule_from_name(argv[i] + 19);
+            if (!rule.has_value()) {
+                std::cerr << "Unknown peephole rule `" << argv[i] + 19 << "`" << std::endl;
+                return EXIT_FAILURE;
+            }
+            options.compile.peephole_options.enabled[static_cast<size_t>(*rule)] = false;
+        }
+        else if (std::strcmp(argv[i], "--peephole-stats") == 0) {
+            options.stats = true;
+        }
+        else if (std::strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = std::strtoul(argv[i] + 10, nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--time-passes") == 0) {
+            options.time_passes = true;
+        }
+        else if (std::strcmp(argv[i], "--stats") == 0) {
+            options.counter_stats = true;
+        }
+        else if (std::strcmp(argv[i], "--stats-json") == 0) {
+            options.stats_json = true;
+        }
+        else if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0') {
+            jobs = std::strtoul(argv[i] + 2, nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--watch") == 0) {
+            options.watch = true;
+        }
+        else if (std::strcmp(argv[i], "--cache") == 0) {
+            cache_dir = default_cache_dir();
+        }
+        else if (std::strncmp(argv[i], "--cache-dir=", 12) == 0 && argv[i][12] != '\0') {
+            cache_dir = argv[i] + 12;
+        }
+        else if (std::strcmp(argv[i], "--cache-stats") == 0) {
+            cache_stats = true;
+        }
+        else if (std::strncmp(argv[i], "--cache-prune=", 14) == 0) {
+            cache_prune = parse_size(argv[i] + 14);
+            if (!cache_prune.has_value()) {
+                std::cerr << "Invalid size `" << argv[i] + 14 << "`" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (argv[i][0] == '@') {
+            if (!read_response_file(argv[i] + 1, inputs)) {
+                std::cerr << "Failed to read `" << argv[i] + 1 << "`" << std::endl;
+                return EXIT_FAILURE;
+            }
+            batch = true;
+        }
+        else if (argv[i][0] != '-') {
+            inputs.emplace_back(argv[i]);
+        }
+        else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    batch = batch || jobs.has_value() || inputs.size() > 1;
+    // a batch already keeps every core busy with whole units
+    options.compile.threads = threads.value_or(batch ? 1 : 0);
+    const bool cache_command = cache_stats || cache_prune.has_value();
+    if (inputs.empty() && !batch && !cache_command) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (options.watch) {
+        if (batch || inputs.empty() || options.jit || options.vm || options.run_bytecode || options.emit_asm
+            || options.emit_ir || options.emit_bytecode || options.stats || options.time_passes || options.counter_stats
+            || options.stats_json || cache_dir.has_value()) {
+            std::cerr << "`--watch` takes a single input and only writes the executable" << std::endl;
+            return EXIT_FAILURE;
+        }
+        return watch(options, inputs.front());
+    }
+
+    std::optional<CompileCache> cache;
+    if (cache_dir.has_value() || cache_command) {
+        cache.emplace(cache_dir.value_or(default_cache_dir()));
+        if (!cache->ok()) {
+            std::cerr << "Failed to create cache directory `" << cache->dir().string() << "`" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (cache_prune.has_value()) {
+        const CachePruneResult pruned = cache->prune(cache_prune.value());
+        std::cerr << "cache: removed " << pruned.removed_entries << " entr"
+                  << (pruned.removed_entries == 1 ? "y" : "ies") << " (" << pruned.removed_bytes << " bytes), "
+                  << pruned.remaining_bytes << " bytes left" << std::endl;
+    }
+    if (cache_stats) {
+        const CacheStats stats = cache->stats();
+        std::cout << "cache: " << cache->dir().string() << "\n"
+                  << "hits: " << stats.hits << "\n"
+                  << "misses: " << stats.misses << "\n"
+                  << "entries: " << stats.entries << "\n"
+                  << "bytes: " << stats.bytes << std::endl;
+    }
+    if (inputs.empty() && !batch) {
+        return EXIT_SUCCESS;
+    }
+    if (cache_dir.has_value()) {
+        options.cache = &cache.value();
+        options.compiler_id = compiler_identity();
+    }
+
+    int status = EXIT_SUCCESS;
+    if (batch) {
+        if (options.jit || options.vm || options.run_bytecode) {
+            std::cerr << "`--jit`, `--vm` and `--run-bytecode` take a single input" << std::endl;
+            return EXIT_FAILURE;
+        }
+        status = compile_batch(options, inputs, jobs.value_or(0));
+    }
+    else {
+        status = compile_unit(options, inputs.front(), "out");
+    }
+    if (options.cache != nullptr) {
+        options.cache->flush_stats();
+    }
+    return status;
+}
+
 /*
     std::string tokens_to_asm(const std::vector<Token>& tokens)
     {
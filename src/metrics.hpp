@@ -0,0 +1,265 @@
+#pragma once
+
+// Compile-time instrumentation for `--time-passes`, `--stats` and `--stats-json`: wall and CPU time per phase, heap
+// allocations per phase, and the size of what each phase produced. Collected only when `CompileOptions::
+// collect_metrics` is set; otherwise every `PhaseTimer` is a null check.
+
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+struct AllocationCounts {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+};
+
+// Heap allocations made by this thread so far. They are counted by the replacement `operator new` in alloc_hook.cpp,
+// which sets `g_allocation_hook`; a program that doesn't link it (a libio host, say) gets zeros.
+inline thread_local AllocationCounts t_allocations;
+inline bool g_allocation_hook = false;
+
+struct PhaseTime {
+    std::string name;
+    double wall_ms = 0;
+    double cpu_ms = 0; // of the thread that ran the phase and of its `PhaseTimer::counted` tasks
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+};
+
+struct CompileMetrics {
+    std::vector<PhaseTime> phases; // in the order they ran
+
+    uint64_t source_bytes = 0;
+    uint64_t tokens = 0;
+    uint64_t symbols = 0; // distinct identifiers
+    uint64_t ast_nodes = 0;
+    uint64_t statements = 0;
+    uint64_t ir_instrs = 0;
+    uint64_t machine_instrs = 0; // after the peephole optimizer
+    uint64_t code_bytes = 0;
+    uint64_t arena_bytes = 0; // AST arena: handed out
+    uint64_t arena_high_water = 0;
+    uint64_t arena_reserved = 0; // obtained from malloc
+    uint64_t max_rss_bytes = 0; // whole process, filled in by the driver
+
+    [[nodiscard]] inline PhaseTime total() const
+    {
+        PhaseTime total { .name = "total" };
+        for (const PhaseTime& phase : phases) {
+            total.wall_ms += phase.wall_ms;
+            total.cpu_ms += phase.cpu_ms;
+            total.allocations += phase.allocations;
+            total.allocated_bytes += phase.allocated_bytes;
+        }
+        return total;
+    }
+
+    inline void print_time_passes(std::ostream& out, std::string_view input) const
+    {
+        out << "===- time passes: " << input << " -===\n";
+        out << "  " << std::left << std::setw(10) << "phase" << std::right << std::setw(12) << "wall ms"
+            << std::setw(12) << "cpu ms" << std::setw(8) << "%" << std::setw(12) << "allocs" << std::setw(14)
+            << "alloc bytes" << "\n";
+        const PhaseTime sum = total();
+        const auto row = [&](const PhaseTime& phase) {
+            out << "  " << std::left << std::setw(10) << phase.name << std::right << std::fixed << std::setprecision(3)
+                << std::setw(12) << phase.wall_ms << std::setw(12) << phase.cpu_ms << std::setprecision(1)
+                << std::setw(8) << (sum.wall_ms > 0 ? 100.0 * phase.wall_ms / sum.wall_ms : 0.0);
+            if (g_allocation_hook) {
+                out << std::setw(12) << phase.allocations << std::setw(14) << phase.allocated_bytes;
+            }
+            else {
+                out << std::setw(12) << "-" << std::setw(14) << "-";
+            }
+            out << "\n";
+        };
+        for (const PhaseTime& phase : phases) {
+            row(phase);
+        }
+        row(sum);
+        out.unsetf(std::ios::fixed);
+    }
+
+    inline void print_stats(std::ostream& out, std::string_view input) const
+    {
+        out << "===- stats: " << input << " -===\n";
+        for (const auto& [name, value] : counters()) {
+            out << "  " << std::left << std::setw(18) << name << std::right << std::setw(14) << value << "\n";
+        }
+    }
+
+    // `{"input":...,"phases":[...],"total":{...},"counters":{...}}`, on one line without a newline. Allocation fields
+    // are null without the hook.
+    inline void write_json(std::ostream& out, std::string_view input) const
+    {
+        out << "{\"input\":";
+        json_string(out, input);
+        out << ",\"phases\":[";
+        for (size_t i = 0; i < phases.size(); i++) {
+            out << (i == 0 ? "" : ",");
+            json_phase(out, phases[i]);
+        }
+        out << "],\"total\":";
+        json_phase(out, total());
+        out << ",\"counters\":{";
+        bool first = true;
+        for (const auto& [name, value] : counters()) {
+            out << (first ? "" : ",") << "\"" << name << "\":" << value;
+            first = false;
+        }
+        out << "}}";
+    }
+
+private:
+    [[nodiscard]] inline std::vector<std::pair<const char*, uint64_t>> counters() const
+    {
+        return {
+            { "source_bytes", source_bytes },
+            { "tokens", tokens },
+            { "symbols", symbols },
+            { "ast_nodes", ast_nodes },
+            { "statements", statements },
+            { "ir_instrs", ir_instrs },
+            { "machine_instrs", machine_instrs },
+            { "code_bytes", code_bytes },
+            { "arena_bytes", arena_bytes },
+            { "arena_high_water", arena_high_water },
+            { "arena_reserved", arena_reserved },
+            { "max_rss_bytes", max_rss_bytes },
+        };
+    }
+
+    static inline void json_string(std::ostream& out, std::string_view text)
+    {
+        out << '"';
+        for (const char c : text) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out << escaped;
+            }
+            else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+    static inline void json_phase(std::ostream& out, const PhaseTime& phase)
+    {
+        std::ostringstream ms;
+        ms << std::fixed << std::setprecision(3) << "\"wall_ms\":" << phase.wall_ms << ",\"cpu_ms\":" << phase.cpu_ms;
+        out << "{\"name\":";
+        json_string(out, phase.name);
+        out << "," << ms.str();
+        if (g_allocation_hook) {
+            out << ",\"allocations\":" << phase.allocations << ",\"allocated_bytes\":" << phase.allocated_bytes;
+        }
+        else {
+            out << ",\"allocations\":null,\"allocated_bytes\":null";
+        }
+        out << "}";
+    }
+};
+
+/**
+ * Times the enclosing scope as one phase of `metrics` (nothing when it's null). CPU time and allocations are this
+ * thread's, so units compiled side by side with `-j` don't count each other's work, plus those of the tasks the phase
+ * hands to a thread pool through `counted`, so a parallel phase isn't under-reported.
+ */
+class PhaseTimer {
+public:
+    inline PhaseTimer(CompileMetrics* metrics, const char* name)
+        : m_metrics(metrics)
+        , m_name(name)
+    {
+        if (m_metrics != nullptr) {
+            m_outer = t_phase;
+            t_phase = this;
+            m_allocations = t_allocations;
+            m_cpu_start = thread_cpu_ms();
+            m_wall_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    /**
+     * Wrap `fn(i)` for `ThreadPool::parallel_for`, so calls on other threads count toward the phase running on this
+     * one. Calls the pool makes on this thread (it helps while it waits) are already in its own counters.
+     */
+    template <typename Fn>
+    [[nodiscard]] static inline auto counted(Fn fn)
+    {
+        return [phase = t_phase, fn = std::move(fn)](size_t i) {
+            if (phase == nullptr || t_phase == phase) {
+                fn(i);
+                return;
+            }
+            const AllocationCounts allocations = t_allocations;
+            const double cpu_start = thread_cpu_ms();
+            fn(i);
+            phase->m_task_cpu_ns.fetch_add(static_cast<uint64_t>((thread_cpu_ms() - cpu_start) * 1e6),
+                                           std::memory_order_relaxed);
+            phase->m_task_allocations.fetch_add(t_allocations.count - allocations.count, std::memory_order_relaxed);
+            phase->m_task_allocated_bytes.fetch_add(t_allocations.bytes - allocations.bytes, std::memory_order_relaxed);
+        };
+    }
+
+    // make it non-copyable
+    inline PhaseTimer(const PhaseTimer& other) = delete;
+
+    inline PhaseTimer operator=(const PhaseTimer& other) = delete;
+
+    inline ~PhaseTimer()
+    {
+        if (m_metrics == nullptr) {
+            return;
+        }
+        const auto wall_end = std::chrono::steady_clock::now();
+        const double cpu_end = thread_cpu_ms();
+        const AllocationCounts allocations = t_allocations;
+        t_phase = m_outer;
+        // the pool has finished every task by the time the phase ends
+        m_metrics->phases.push_back({
+            .name = m_name,
+            .wall_ms = std::chrono::duration<double, std::milli>(wall_end - m_wall_start).count(),
+            .cpu_ms = cpu_end - m_cpu_start + static_cast<double>(m_task_cpu_ns.load()) / 1e6,
+            .allocations = allocations.count - m_allocations.count + m_task_allocations.load(),
+            .allocated_bytes = allocations.bytes - m_allocations.bytes + m_task_allocated_bytes.load(),
+        });
+    }
+
+    [[nodiscard]] static inline double thread_cpu_ms()
+    {
+        timespec ts {};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<double>(ts.tv_sec) * 1e3 + static_cast<double>(ts.tv_nsec) / 1e6;
+    }
+
+private:
+    static inline thread_local PhaseTimer* t_phase = nullptr; // innermost on this thread
+
+    CompileMetrics* m_metrics;
+    const char* m_name;
+    PhaseTimer* m_outer = nullptr;
+    AllocationCounts m_allocations;
+    double m_cpu_start = 0;
+    std::chrono::steady_clock::time_point m_wall_start;
+    // of `counted` tasks that ran on other threads
+    std::atomic<uint64_t> m_task_cpu_ns = 0;
+    std::atomic<uint64_t> m_task_allocations = 0;
+    std::atomic<uint64_t> m_task_allocated_bytes = 0;
+};
@@ -0,0 +1,274 @@
+#pragma once
+
+// Middle-end passes over the parsed `NodeProg`, run before `Generator::gen_prog`:
+//
+//  - fold: evaluate binary nodes whose operands are constants, with the same 64-bit wraparound the generated
+//    add/sub/imul have. Division is only folded when it can't trap (`x / 0`, `INT64_MIN / -1` stay for runtime).
+//  - propagate: replace uses of a `let` whose initializer folded to a constant by that constant.
+//  - dead-let: drop `let`s nobody reads (after propagation most constant ones), transitively.
+//  - unreachable: drop statements after the first `exit`; there's no control flow, so they can never run.
+//  - compact: rewrite the node arrays in place so every expression is a contiguous post-order range again.
+//
+// Programs with undeclared or redeclared identifiers are left untouched so the generator still reports them.
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+#include "parser.hpp"
+
+struct OptimizerStats {
+    size_t folded = 0; // binary nodes replaced by their value
+    size_t propagated = 0; // identifier uses replaced by a constant
+    size_t dead_lets = 0;
+    size_t unreachable_stmts = 0;
+    size_t nodes_before = 0;
+    size_t nodes_after = 0;
+    bool skipped = false; // program has a semantic error, left as is
+
+    inline void print(std::ostream& out) const
+    {
+        if (skipped) {
+            out << "optimizer: skipped (semantic errors)\n";
+            return;
+        }
+        out << "optimizer:\n";
+        out << "    fold: " << folded << " node(s) folded\n";
+        out << "    propagate: " << propagated << " use(s) replaced by constants\n";
+        out << "    dead-let: " << dead_lets << " let(s) removed\n";
+        out << "    unreachable: " << unreachable_stmts << " statement(s) removed\n";
+        out << "    compact: " << nodes_before << " -> " << nodes_after << " nodes\n";
+    }
+};
+
+class Optimizer {
+public:
+    inline explicit Optimizer(NodeProg& prog)
+        : m_prog(prog)
+    {
+    }
+
+    inline OptimizerStats run()
+    {
+        m_stats = {};
+        m_stats.nodes_before = m_prog.node_count;
+        if (!resolve()) {
+            m_stats.skipped = true;
+            m_stats.nodes_after = m_prog.node_count;
+            return m_stats;
+        }
+        fold_and_propagate();
+        remove_unreachable();
+        remove_dead_lets();
+        compact();
+        m_stats.nodes_after = m_prog.node_count;
+        return m_stats;
+    }
+
+private:
+    static constexpr uint32_t NO_BINDING = std::numeric_limits<uint32_t>::max();
+
+    NodeProg& m_prog;
+    OptimizerStats m_stats;
+    std::vector<uint32_t> m_binding_of; // ident use -> index in `stmts` of the `let` it reads
+
+    // Bind every identifier use to its `let`. False on undeclared/redeclared names.
+    inline bool resolve()
+    {
+        std::vector<uint32_t> lets(m_prog.symbol_count(), NO_BINDING); // by symbol id
+        m_binding_of.assign(m_prog.node_count, NO_BINDING);
+        for (size_t k = 0; k < m_prog.stmts.size(); k++) {
+            const NodeId stmt = m_prog.stmts[k];
+            const NodeId expr = stmt_expr(stmt);
+            for (NodeId id = m_prog.first_node(expr); id <= expr; id++) {
+                if (m_prog.kind(id) == NodeKind::ident) {
+                    const uint32_t let = lets[m_prog.symbol(id)];
+                    if (let == NO_BINDING) {
+                        return false;
+                    }
+                    m_binding_of[id] = let;
+                }
+            }
+            if (m_prog.kind(stmt) == NodeKind::stmt_let) {
+                uint32_t& let = lets[m_prog.symbol(m_prog.lhs(stmt))];
+                if (let != NO_BINDING) {
+                    return false;
+                }
+                let = static_cast<uint32_t>(k);
+            }
+        }
+        return true;
+    }
+
+    [[nodiscard]] inline NodeId stmt_expr(NodeId stmt) const
+    {
+        return m_prog.kind(stmt) == NodeKind::stmt_let ? m_prog.rhs(stmt) : m_prog.lhs(stmt);
+    }
+
+    // Folding happens in place, bottom-up in id order: by the time a node is visited its operands are final.
+    inline void fold_and_propagate()
+    {
+        for (const NodeId stmt : m_prog.stmts) {
+            const NodeId expr = stmt_expr(stmt);
+            for (NodeId id = m_prog.first_node(expr); id <= expr; id++) {
+                const NodeKind kind = m_prog.kind(id);
+                if (kind == NodeKind::ident) {
+                    const NodeId init = stmt_expr(m_prog.stmts[m_binding_of[id]]);
+                    if (m_prog.kind(init) == NodeKind::int_lit) {
+                        m_prog.set_int_lit(id, m_prog.int_value(init));
+                        m_stats.propagated++;
+                    }
+                }
+                else if (NodeProg::is_bin_expr(kind) && m_prog.kind(m_prog.lhs(id)) == NodeKind::int_lit
+                         && m_prog.kind(m_prog.rhs(id)) == NodeKind::int_lit) {
+                    int64_t value;
+                    if (eval(kind, m_prog.int_value(m_prog.lhs(id)), m_prog.int_value(m_prog.rhs(id)), value)) {
+                        m_prog.set_int_lit(id, value);
+                        m_stats.folded++;
+                    }
+                }
+            }
+        }
+    }
+
+    static inline bool eval(NodeKind kind, int64_t lhs, int64_t rhs, int64_t& out)
+    {
+        const auto l = static_cast<uint64_t>(lhs);
+        const auto r = static_cast<uint64_t>(rhs);
+        switch (kind) {
+        case NodeKind::bin_add:
+            out = static_cast<int64_t>(l + r);
+            return true;
+        case NodeKind::bin_sub:
+            out = static_cast<int64_t>(l - r);
+            return true;
+        case NodeKind::bin_mul:
+            out = static_cast<int64_t>(l * r);
+            return true;
+        case NodeKind::bin_div:
+            if (rhs == 0 || (lhs == std::numeric_limits<int64_t>::min() && rhs == -1)) {
+                return false; // traps at runtime, keep it that way
+            }
+            out = lhs / rhs;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Whether evaluating `expr` can trap: it has a division by anything but a literal other than 0 and -1. Folding
+    // only turns a division into a literal together with its whole subtree, so any `bin_div` left in the range is live.
+    [[nodiscard]] inline bool may_trap(NodeId expr) const
+    {
+        for (NodeId id = m_prog.first_node(expr); id <= expr; id++) {
+            if (m_prog.kind(id) != NodeKind::bin_div) {
+                continue;
+            }
+            const NodeId divisor = m_prog.rhs(id);
+            if (m_prog.kind(divisor) != NodeKind::int_lit || m_prog.int_value(divisor) == 0
+                || m_prog.int_value(divisor) == -1) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline void remove_unreachable()
+    {
+        for (size_t k = 0; k < m_prog.stmts.size(); k++) {
+            if (m_prog.kind(m_prog.stmts[k]) == NodeKind::stmt_exit) {
+                m_stats.unreachable_stmts += m_prog.stmts.size() - k - 1;
+                m_prog.stmts.resize(k + 1);
+                break;
+            }
+        }
+    }
+
+    // Lets only see earlier lets, so one backward sweep finds everything transitively unused. Identifiers are never
+    // left behind inside folded subtrees (an ident only folds by becoming a literal itself), so scanning the id range
+    // of a live expression sees exactly its live uses. An unused `let` that may trap is kept, like `eval` keeps the
+    // division: the program has to die at it either way.
+    inline void remove_dead_lets()
+    {
+        std::vector<bool> used(m_prog.stmts.size(), false);
+        std::vector<bool> keep(m_prog.stmts.size(), true);
+        for (size_t k = m_prog.stmts.size(); k-- > 0;) {
+            const NodeId stmt = m_prog.stmts[k];
+            if (m_prog.kind(stmt) == NodeKind::stmt_let && !used[k] && !may_trap(stmt_expr(stmt))) {
+                keep[k] = false;
+                m_stats.dead_lets++;
+                continue;
+            }
+            const NodeId expr = stmt_expr(stmt);
+            for (NodeId id = m_prog.first_node(expr); id <= expr; id++) {
+                if (m_prog.kind(id) == NodeKind::ident) {
+                    used[m_binding_of[id]] = true;
+                }
+            }
+        }
+        size_t w = 0;
+        for (size_t k = 0; k < m_prog.stmts.size(); k++) {
+            if (keep[k]) {
+                m_prog.stmts[w++] = m_prog.stmts[k];
+            }
+        }
+        m_prog.stmts.resize(w);
+    }
+
+    // Mark what's reachable from the statements (children always have lower ids, so one backward sweep), then slide
+    // the survivors down in id order. Survivors keep their relative order, so the result is post-order again and each
+    // node only ever moves to a slot that has already been read.
+    inline void compact()
+    {
+        std::vector<bool> alive(m_prog.node_count, false);
+        for (const NodeId stmt : m_prog.stmts) {
+            alive[stmt] = true;
+        }
+        for (NodeId id = m_prog.node_count; id-- > 0;) {
+            if (!alive[id]) {
+                continue;
+            }
+            switch (m_prog.kind(id)) {
+            case NodeKind::stmt_let:
+            case NodeKind::bin_add:
+            case NodeKind::bin_sub:
+            case NodeKind::bin_mul:
+            case NodeKind::bin_div:
+                alive[m_prog.lhs(id)] = true;
+                alive[m_prog.rhs(id)] = true;
+                break;
+            case NodeKind::stmt_exit:
+                alive[m_prog.lhs(id)] = true;
+                break;
+            case NodeKind::int_lit:
+            case NodeKind::ident:
+                break;
+            }
+        }
+
+        std::vector<NodeId> new_id(m_prog.node_count, 0);
+        NodeId w = 0;
+        for (NodeId id = 0; id < m_prog.node_count; id++) {
+            if (!alive[id]) {
+                continue;
+            }
+            const NodeKind kind = m_prog.kind(id);
+            NodeData data = m_prog.data[id];
+            if (NodeProg::is_bin_expr(kind) || kind == NodeKind::stmt_let) {
+                data = { .lhs = new_id[data.lhs], .rhs = new_id[data.rhs] };
+            }
+            else if (kind == NodeKind::stmt_exit) {
+                data.lhs = new_id[data.lhs];
+            }
+            m_prog.kinds[w] = kind;
+            m_prog.data[w] = data;
+            new_id[id] = w++;
+        }
+        m_prog.node_count = w;
+        for (NodeId& stmt : m_prog.stmts) {
+            stmt = new_id[stmt];
+        }
+    }
+};
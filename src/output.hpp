@@ -0,0 +1,201 @@
+#pragma once
+
+// Buffered writer for output files. Everything goes through one fixed-size buffer that is flushed to the file
+// descriptor whenever it fills up, so writing a program never needs a second in-memory copy of it, and numbers are
+// formatted with `std::to_chars` instead of iostreams. `StringOutput` has the same interface for in-memory results.
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+class OutputFile {
+public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    // Creates or replaces `path` with a file of mode `mode`.
+    inline explicit OutputFile(const std::string& path, mode_t mode = 0644)
+        : m_buffer(new char[BUFFER_SIZE])
+    {
+        // like `ld`, replace an existing regular file instead of truncating it: it may be a read-only hardlink into the
+        // compilation cache
+        struct stat st { };
+        if (lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            unlink(path.c_str());
+        }
+        m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+        m_ok = m_fd >= 0 && fchmod(m_fd, mode) == 0;
+    }
+
+    // make it non-copyable
+    inline OutputFile(const OutputFile& other) = delete;
+
+    inline OutputFile operator=(const OutputFile& other) = delete;
+
+    inline ~OutputFile()
+    {
+        close();
+    }
+
+    // False once anything failed (open, write, seek); later writes are dropped.
+    [[nodiscard]] inline bool ok() const
+    {
+        return m_ok;
+    }
+
+    // Bytes written so far, including what is still buffered.
+    [[nodiscard]] inline uint64_t size() const
+    {
+        return m_flushed + m_used;
+    }
+
+    inline void write(const void* data, size_t len)
+    {
+        const auto* bytes = static_cast<const char*>(data);
+        if (len > BUFFER_SIZE - m_used) {
+            flush();
+            if (len >= BUFFER_SIZE) {
+                write_fully(bytes, len);
+                return;
+            }
+        }
+        std::memcpy(m_buffer.get() + m_used, bytes, len);
+        m_used += len;
+    }
+
+    inline void write(std::string_view text)
+    {
+        write(text.data(), text.size());
+    }
+
+    inline void put(char c)
+    {
+        if (m_used == BUFFER_SIZE) {
+            flush();
+        }
+        m_buffer[m_used++] = c;
+    }
+
+    inline void write_int(int64_t value)
+    {
+        char digits[24];
+        const auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+        write(digits, static_cast<size_t>(end - digits));
+    }
+
+    // Overwrite already written bytes at `offset` (e.g. a header whose sizes are only known at the end).
+    inline void patch(uint64_t offset, const void* data, size_t len)
+    {
+        flush();
+        if (!m_ok) {
+            return;
+        }
+        const auto* bytes = static_cast<const char*>(data);
+        while (len > 0) {
+            const ssize_t n = pwrite(m_fd, bytes, len, static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                m_ok = false;
+                return;
+            }
+            bytes += n;
+            len -= static_cast<size_t>(n);
+            offset += static_cast<uint64_t>(n);
+        }
+    }
+
+    inline void flush()
+    {
+        write_fully(m_buffer.get(), m_used);
+        m_used = 0;
+    }
+
+    // Flush and close; returns whether everything was written.
+    inline bool close()
+    {
+        if (m_fd >= 0) {
+            flush();
+            if (::close(m_fd) != 0) {
+                m_ok = false;
+            }
+            m_fd = -1;
+        }
+        return m_ok;
+    }
+
+private:
+    int m_fd = -1;
+    bool m_ok = false;
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_used = 0;
+    uint64_t m_flushed = 0;
+
+    inline void write_fully(const char* data, size_t len)
+    {
+        if (!m_ok) {
+            return;
+        }
+        m_flushed += len;
+        while (len > 0) {
+            const ssize_t n = ::write(m_fd, data, len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                m_ok = false;
+                return;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+    }
+};
+
+// `OutputFile`'s writing interface on top of a `std::string`, for results returned in memory.
+class StringOutput {
+public:
+    inline void write(const void* data, size_t len)
+    {
+        m_str.append(static_cast<const char*>(data), len);
+    }
+
+    inline void write(std::string_view text)
+    {
+        m_str.append(text);
+    }
+
+    inline void put(char c)
+    {
+        m_str.push_back(c);
+    }
+
+    inline void write_int(int64_t value)
+    {
+        char digits[24];
+        const auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+        m_str.append(digits, static_cast<size_t>(end - digits));
+    }
+
+    [[nodiscard]] inline uint64_t size() const
+    {
+        return m_str.size();
+    }
+
+    [[nodiscard]] inline std::string take()
+    {
+        return std::move(m_str);
+    }
+
+private:
+    std::string m_str;
+};
@@ -1,189 +1,218 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <optional>
 #include <ostream>
-#include <variant>
+#include <string>
+#include <string_view>
 #include <vector>
 
 #include "arena.hpp"
+#include "diagnostics.hpp"
 #include "tokenization.hpp"
 
-struct NodeTermIntLit {
-    Token int_lit;
-};
+// The AST is flat: every node is a one-byte `NodeKind` plus an 8-byte `NodeData`, stored in two contiguous arrays and
+// referred to by 32-bit `NodeId`s. Children are ids, not pointers, so there's no per-node allocation and walking the
+// tree touches two dense arrays instead of chasing `std::variant`s of pointers.
+//
+// The parser appends nodes in post-order (children before parents), so every expression occupies the contiguous id
+// range `[first_node(root), root]` and can be generated with a linear loop.
 
-struct NodeTermIdent {
-    Token ident;
-};
+using NodeId = uint32_t;
 
-struct NodeExpr; // Forward declare NodeExpr
-                 // use pointer to satisfy incomplete type error tldr; we need to know size of NodeExpr to avoid
-                 // circular definitions so we need to dynamically allocate the data and store it somewhere, but they
-                 // are small so alloc and free will be expensive as they have small memory footprint and worsens CPU
-                 // cache causing cache miss. so we need a contiguos memory with Area Allocator (loan of memory e.g.
-                 // 1mb). Then we just advance a pointer by 1 unit or the pointer/elements size. so all elements are
-                 // next to each other. |1|  3|    4| 2|1|1|. No prob with lifetimes, and can use raw pointers. Then
-                 // free all at once after generation.
-
-struct NodeBinExprAdd {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
+enum class NodeKind : uint8_t {
+    int_lit, // data: the 64-bit value (`NodeProg::int_value`)
+    ident, // data: source offset, symbol id (`NodeProg::symbol`, `NodeProg::ident`)
+    bin_add, // data: lhs, rhs
+    bin_sub, // data: lhs, rhs
+    bin_mul, // data: lhs, rhs
+    bin_div, // data: lhs, rhs
+    stmt_exit, // data: expr
+    stmt_let, // data: ident node, expr
 };
 
-// struct NodeBinExprMulti {
-//     NodeExpr* lhs;
-//     NodeExpr* rhs;
-// };
-//
-// struct NodeBinExprSub {
-//     NodeExpr* lhs;
-//     NodeExpr* rhs;
-// };
-//
-// struct NodeBinExprDiv {
-//     NodeExpr* lhs;
-//     NodeExpr* rhs;
-// };
-
-struct NodeBinExpr {
-    // std::variant<NodeBinExprAdd*, NodeBinExprMulti*> var;
-    std::variant<NodeBinExprAdd*> var;
+struct NodeData {
+    uint32_t lhs = 0;
+    uint32_t rhs = 0;
 };
 
-struct NodeTerm {
-    std::variant<NodeTermIntLit*, NodeTermIdent*> var;
-};
+struct NodeProg {
+    std::string_view src;
+    const SymbolTable* symbols = nullptr; // names of the `ident` nodes, owned by the parser's token stream
+    NodeKind* kinds = nullptr; // indexed by `NodeId`, owned by the parser's arena
+    NodeData* data = nullptr;
+    uint32_t node_count = 0;
+    std::vector<NodeId> stmts;
 
-struct NodeExpr {
-    // Token int_lit;
-    std::variant<NodeTerm*, NodeBinExpr*> var;
-};
+    [[nodiscard]] inline NodeKind kind(NodeId id) const
+    {
+        return kinds[id];
+    }
 
-struct NodeStmtExit {
-    NodeExpr* expr;
-};
+    [[nodiscard]] inline NodeId lhs(NodeId id) const
+    {
+        return data[id].lhs;
+    }
 
-struct NodeStmtLet {
-    Token ident; // no need for it as we moved tokens in Parser?
-    NodeExpr* expr;
-};
+    [[nodiscard]] inline NodeId rhs(NodeId id) const
+    {
+        return data[id].rhs;
+    }
 
-struct NodeStmt {
-    std::variant<NodeStmtExit*, NodeStmtLet*> var;
-};
+    [[nodiscard]] inline int64_t int_value(NodeId id) const
+    {
+        return static_cast<int64_t>(static_cast<uint64_t>(data[id].lhs) | static_cast<uint64_t>(data[id].rhs) << 32);
+    }
 
-struct NodeProg {
-    std::vector<NodeStmt*> stmts;
+    [[nodiscard]] inline static NodeData int_data(int64_t value)
+    {
+        const auto bits = static_cast<uint64_t>(value);
+        return { .lhs = static_cast<uint32_t>(bits), .rhs = static_cast<uint32_t>(bits >> 32) };
+    }
+
+    // Turn any node into an int literal in place (constant folding); its old children become unreachable.
+    inline void set_int_lit(NodeId id, int64_t value)
+    {
+        kinds[id] = NodeKind::int_lit;
+        data[id] = int_data(value);
+    }
+
+    [[nodiscard]] inline SymbolId symbol(NodeId id) const
+    {
+        return data[id].rhs;
+    }
+
+    [[nodiscard]] inline std::string_view ident(NodeId id) const
+    {
+        return symbols->name(data[id].rhs);
+    }
+
+    // Bound on every `symbol()`, for tables indexed by it.
+    [[nodiscard]] inline size_t symbol_count() const
+    {
+        return symbols->size();
+    }
+
+    [[nodiscard]] inline static bool is_bin_expr(NodeKind kind)
+    {
+        return kind == NodeKind::bin_add || kind == NodeKind::bin_sub || kind == NodeKind::bin_mul
+            || kind == NodeKind::bin_div;
+    }
+
+    // First node of the expression rooted at `root` in post-order: its leftmost leaf.
+    [[nodiscard]] inline NodeId first_node(NodeId root) const
+    {
+        while (is_bin_expr(kinds[root])) {
+            root = data[root].lhs;
+        }
+        return root;
+    }
 };
 
 class Parser {
 public:
-    inline explicit Parser(std::vector<Token> tokens)
+    inline explicit Parser(TokenStream tokens)
         : m_tokens(std::move(tokens))
-        , m_allocator(1024 * 1024 * 4) // 4 mb
     {
+        m_prog.src = m_tokens.src;
+        m_prog.symbols = &m_tokens.symbols;
+        // every node consumes at least one token, so this is normally the only allocation
+        reserve_nodes(m_tokens.size() + 1);
     }
 
-    std::optional<NodeTerm*> parse_term()
+    std::optional<NodeId> parse_term()
     {
         if (auto int_lit = try_consume(TokenType::int_lit)) {
-            auto term_int_lit = m_allocator.alloc<NodeTermIntLit>();
-            term_int_lit->int_lit = int_lit.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_int_lit;
-            return term;
-        }
-        else if (peek().has_value() && peek().value().type == TokenType::ident) {
-            auto term_ident = m_allocator.alloc<NodeTermIdent>();
-            term_ident->ident = consume();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_ident;
-            return term;
+            return add_node(NodeKind::int_lit, NodeProg::int_data(m_tokens.int_value(int_lit.value())));
+        }
+        else if (peek() == TokenType::ident) {
+            return add_ident(consume());
         }
         else {
             return {};
         }
     }
 
-    std::optional<NodeExpr*> parse_expr()
-    {
-        if (auto term = parse_term()) {
-            if (try_consume(TokenType::plus).has_value()) {
-                auto bin_expr = m_allocator.alloc<NodeBinExpr>();
-                auto bin_expr_add = m_allocator.alloc<NodeBinExprAdd>();
-                auto lhs_expr = m_allocator.alloc<NodeExpr>();
-                lhs_expr->var = term.value(); // (1)
-                bin_expr_add->lhs = lhs_expr;
-                /* recursion */
-                if (auto rhs = parse_expr()) {
-                    bin_expr_add->rhs = rhs.value();
-                    bin_expr->var = bin_expr_add;
-                    auto expr = m_allocator.alloc<NodeExpr>();
-                    expr->var = bin_expr;
-                    return expr;
-                }
-                else {
-                    std::cerr << "Expected expression" << std::endl;
-                    exit(EXIT_FAILURE);
-                }
+    /**
+     * Precedence climbing with explicit operand/operator stacks instead of recursion, so `1 + 2 + ... + N` of any
+     * length parses in linear time without touching the C++ call stack. Equal precedence reduces first, which makes
+     * every operator left-associative: `1 - 2 - 3` is `(1 - 2) - 3`.
+     *
+     * Reductions emit nodes in reverse Polish order, which keeps the AST in post-order.
+     */
+    std::optional<NodeId> parse_expr()
+    {
+        auto lhs = parse_term();
+        if (!lhs.has_value()) {
+            return {};
+        }
+        // parse_expr isn't reentrant today, but don't assume the stacks start empty
+        const size_t operands_base = m_operands.size();
+        const size_t operators_base = m_operators.size();
+        m_operands.push_back(lhs.value());
+
+        while (peek().has_value()) {
+            const std::optional<int> prec = bin_prec(peek().value());
+            if (!prec.has_value()) {
+                break;
+            }
+            while (m_operators.size() > operators_base && bin_prec(m_operators.back()).value() >= prec.value()) {
+                reduce();
+            }
+            m_operators.push_back(m_tokens.kinds[consume()]);
+            if (auto rhs = parse_term()) {
+                m_operands.push_back(rhs.value());
             }
             else {
-                auto expr = m_allocator.alloc<NodeExpr>();
-                expr->var = term.value(); // (2)
-                return expr;
+                throw CompileError("Expected expression", current_offset());
             }
         }
-        else {
-            return {};
+        while (m_operators.size() > operators_base) {
+            reduce();
         }
+
+        const NodeId expr = m_operands.back();
+        m_operands.resize(operands_base);
+        return expr;
     }
 
     // TODO: Refactor to `parse_stmt`:
-    std::optional<NodeStmt*> parse_stmt()
+    std::optional<NodeId> parse_stmt()
     {
-        if (peek().value().type == TokenType::exit && peek(1).has_value()
-            && peek(1).value().type == TokenType::open_paren) {
+        if (peek() == TokenType::exit && peek(1) == TokenType::open_paren) {
             consume();
             consume(); // also consume the open paranthesis.
-            auto stmt_exit = m_allocator.alloc<NodeStmtExit>();
+            NodeId expr;
             if (auto node_expr = parse_expr()) {
-                stmt_exit->expr = node_expr.value();
+                expr = node_expr.value();
             }
             else {
-                std::cerr << "Invalid expression" << std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError("Invalid expression", current_offset());
             }
             try_consume(TokenType::close_paren, "Expected `)` `semi`");
             try_consume(TokenType::semi, "Expected `;` `semi`");
-            auto stmt = m_allocator.alloc<NodeStmt>();
-            stmt->var = stmt_exit;
-            return stmt;
-        }
-        else if (
-            peek().has_value() && peek().value().type == TokenType::let && peek(1).has_value()
-            && peek(1).value().type == TokenType::ident && peek(2).has_value()
-            && peek(2).value().type == TokenType::eq) {
+            return add_node(NodeKind::stmt_exit, { .lhs = expr });
+        }
+        else if (peek() == TokenType::let && peek(1) == TokenType::ident && peek(2) == TokenType::eq) {
             consume();
-            auto stmt_let = m_allocator.alloc<NodeStmtLet>();
-            stmt_let->ident = consume();
+            const NodeId ident = add_ident(consume());
             consume(); // also consume `=`?
-            if (auto expr = parse_expr()) {
-                stmt_let->expr = expr.value();
+            NodeId expr;
+            if (auto node_expr = parse_expr()) {
+                expr = node_expr.value();
             }
             else {
-                std::cerr << "Invalid expression" << std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError("Invalid expression", current_offset());
             }
             try_consume(TokenType::semi, "Expected `;` `semi`");
-            auto stmt = m_allocator.alloc<NodeStmt>();
-            stmt->var = stmt_let;
-            return stmt;
+            return add_node(NodeKind::stmt_let, { .lhs = ident, .rhs = expr });
         }
         else {
             return {};
@@ -192,53 +221,129 @@ public:
 
     std::optional<NodeProg> parse_prog()
     {
-        NodeProg prog;
         while (peek().has_value()) {
             if (auto stmt = parse_stmt()) {
-                prog.stmts.push_back(stmt.value());
+                m_prog.stmts.push_back(stmt.value());
             }
             else {
-                std::cerr << "Invalid statement" << std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError("Invalid statement", current_offset());
             }
         }
-        return prog;
+        return m_prog;
+    }
+
+    // Holds the AST: it must outlive the `NodeProg` that `parse_prog` returns.
+    [[nodiscard]] inline const ArenaAllocator& arena() const
+    {
+        return m_allocator;
     }
 
 private:
-    const std::vector<Token> m_tokens;
+    const TokenStream m_tokens;
     size_t m_index = 0;
     ArenaAllocator m_allocator;
+    NodeProg m_prog;
+    uint32_t m_node_capacity = 0;
+    std::vector<NodeId> m_operands; // parse_expr's stacks, kept to reuse their storage
+    std::vector<TokenType> m_operators;
 
-    [[nodiscard]] inline std::optional<Token> peek(int offset = 0) const
+    // Pop an operator and its two operands, push the combined node.
+    inline void reduce()
+    {
+        const TokenType op = m_operators.back();
+        m_operators.pop_back();
+        const NodeId rhs = m_operands.back();
+        m_operands.pop_back();
+        const NodeId lhs = m_operands.back();
+        m_operands.pop_back();
+
+        NodeKind kind;
+        switch (op) {
+        case TokenType::plus:
+            kind = NodeKind::bin_add;
+            break;
+        case TokenType::minus:
+            kind = NodeKind::bin_sub;
+            break;
+        case TokenType::star:
+            kind = NodeKind::bin_mul;
+            break;
+        case TokenType::fslash:
+            kind = NodeKind::bin_div;
+            break;
+        default:
+            assert(false && "not a binary operator");
+            return;
+        }
+        m_operands.push_back(add_node(kind, { .lhs = lhs, .rhs = rhs }));
+    }
+
+    inline void reserve_nodes(size_t capacity)
+    {
+        if (capacity > UINT32_MAX) {
+            throw CompileError("Program too large: more than " + std::to_string(UINT32_MAX) + " AST nodes");
+        }
+        auto* kinds = m_allocator.alloc_array<NodeKind>(capacity);
+        auto* data = m_allocator.alloc_array<NodeData>(capacity);
+        std::copy(m_prog.kinds, m_prog.kinds + m_prog.node_count, kinds);
+        std::copy(m_prog.data, m_prog.data + m_prog.node_count, data);
+        m_prog.kinds = kinds;
+        m_prog.data = data;
+        m_node_capacity = static_cast<uint32_t>(capacity);
+    }
+
+    inline NodeId add_node(NodeKind kind, NodeData data)
+    {
+        if (m_prog.node_count == m_node_capacity) {
+            reserve_nodes(static_cast<size_t>(m_node_capacity) * 2);
+        }
+        const NodeId id = m_prog.node_count++;
+        m_prog.kinds[id] = kind;
+        m_prog.data[id] = data;
+        return id;
+    }
+
+    inline NodeId add_ident(size_t token)
+    {
+        return add_node(NodeKind::ident,
+                        { .lhs = m_tokens.records[token].offset, .rhs = m_tokens.records[token].data });
+    }
+
+    [[nodiscard]] inline std::optional<TokenType> peek(int offset = 0) const
     {
         if (m_index + offset >= m_tokens.size()) {
             return {};
         }
         else {
-            return m_tokens.at(m_index + offset);
+            return m_tokens.kinds[m_index + offset];
         }
     }
 
-    inline Token consume()
+    // Where the next token starts (end of the source if there is none), for error locations.
+    [[nodiscard]] inline size_t current_offset() const
+    {
+        return m_index < m_tokens.size() ? m_tokens.records[m_index].offset : m_tokens.src.size();
+    }
+
+    // Returns the index of the consumed token in `m_tokens`.
+    inline size_t consume()
     {
-        return m_tokens.at(m_index++);
+        return m_index++;
     }
 
-    inline std::optional<Token> try_consume(TokenType type, const std::string& err_msg)
+    inline std::optional<size_t> try_consume(TokenType type, const std::string& err_msg)
     {
-        if (peek().has_value() && peek().value().type == type) {
+        if (peek() == type) {
             return consume();
         }
         else {
-            std::cerr << err_msg << std::endl;
-            exit(EXIT_FAILURE);
+            throw CompileError(err_msg, current_offset());
         }
     }
 
-    inline std::optional<Token> try_consume(TokenType type)
+    inline std::optional<size_t> try_consume(TokenType type)
     {
-        if (peek().has_value() && peek().value().type == type) {
+        if (peek() == type) {
             return consume();
         }
         else {
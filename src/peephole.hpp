@@ -0,0 +1,364 @@
+#pragma once
+
+// Peephole optimizer over the `Instr` stream `Generator` produces, run before it is printed or encoded.
+//
+// Instructions are copied to an output list one at a time; after each one the rules are tried against the tail of
+// the output (at most `window` instructions) until none matches, so a rewrite can expose another one right behind it.
+// Generated code is straight-line, so a single backward pass gives exact register liveness, which rules use to prove
+// that a register they stop writing is never read again.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "x86_64.hpp"
+
+enum class PeepholeRule : uint8_t {
+    push_pop, // push X; pop Y               -> mov Y, X (nothing if X is Y)
+    push_pop_around, // push X; I; pop S     -> I; mov S, X, when I leaves X and the stack alone
+    copy_prop, // mov R, X; mov S, R         -> mov S, X, when R is dead afterwards (`xor R, R` is `mov R, 0`)
+    imm_operand, // mov S, imm; op R, S      -> op R, imm, when S is dead afterwards (add/sub)
+    dead_mov, // mov R, X / xor R, R         -> nothing, when R is dead afterwards
+    count,
+};
+
+inline const char* peephole_rule_name(PeepholeRule rule)
+{
+    switch (rule) {
+    case PeepholeRule::push_pop:
+        return "push-pop";
+    case PeepholeRule::push_pop_around:
+        return "push-pop-around";
+    case PeepholeRule::copy_prop:
+        return "copy-prop";
+    case PeepholeRule::imm_operand:
+        return "imm-operand";
+    case PeepholeRule::dead_mov:
+        return "dead-mov";
+    case PeepholeRule::count:
+        break;
+    }
+    return "?";
+}
+
+// inverse of `peephole_rule_name`
+inline std::optional<PeepholeRule> peephole_rule_from_name(std::string_view name)
+{
+    for (size_t i = 0; i < static_cast<size_t>(PeepholeRule::count); i++) {
+        if (name == peephole_rule_name(static_cast<PeepholeRule>(i))) {
+            return static_cast<PeepholeRule>(i);
+        }
+    }
+    return {};
+}
+
+struct PeepholeOptions {
+    size_t window = 3; // rules that need to look at more instructions than this are skipped
+    std::array<bool, static_cast<size_t>(PeepholeRule::count)> enabled = { true, true, true, true, true };
+    size_t max_passes = 4;
+};
+
+class PeepholeOptimizer {
+public:
+    inline explicit PeepholeOptimizer(PeepholeOptions options = {})
+        : m_options(options)
+    {
+    }
+
+    inline void run(std::vector<Instr>& instrs)
+    {
+        for (size_t pass = 0; pass < m_options.max_passes; pass++) {
+            m_changed = false;
+            run_pass(instrs);
+            m_passes++;
+            if (!m_changed) {
+                break;
+            }
+        }
+    }
+
+    // instructions removed by each rule, summed over all runs
+    [[nodiscard]] inline size_t removed(PeepholeRule rule) const
+    {
+        return m_removed[static_cast<size_t>(rule)];
+    }
+
+    [[nodiscard]] inline size_t applied(PeepholeRule rule) const
+    {
+        return m_applied[static_cast<size_t>(rule)];
+    }
+
+    inline void print_stats(std::ostream& out) const
+    {
+        out << "peephole: " << m_passes << " pass(es), window " << m_options.window << "\n";
+        for (size_t i = 0; i < static_cast<size_t>(PeepholeRule::count); i++) {
+            const auto rule = static_cast<PeepholeRule>(i);
+            out << "    " << peephole_rule_name(rule) << ": applied " << applied(rule) << ", removed " << removed(rule)
+                << (m_options.enabled[i] ? "" : " (disabled)") << "\n";
+        }
+    }
+
+private:
+    using RegMask = uint32_t;
+
+    PeepholeOptions m_options;
+    std::array<size_t, static_cast<size_t>(PeepholeRule::count)> m_removed {};
+    std::array<size_t, static_cast<size_t>(PeepholeRule::count)> m_applied {};
+    size_t m_passes = 0;
+    bool m_changed = false;
+    std::vector<RegMask> m_live_after;
+    std::vector<Instr> m_out;
+
+    static inline RegMask bit(Reg reg)
+    {
+        return 1u << static_cast<uint8_t>(reg);
+    }
+
+    static inline bool is_reg(const Operand& operand)
+    {
+        return operand.kind == Operand::Kind::reg;
+    }
+
+    static inline bool is_reg(const Operand& operand, Reg reg)
+    {
+        return operand.kind == Operand::Kind::reg && operand.reg == reg;
+    }
+
+    // registers an operand reads when used as a source (or as a memory address)
+    static inline RegMask reads(const Operand& operand)
+    {
+        switch (operand.kind) {
+        case Operand::Kind::reg:
+        case Operand::Kind::mem:
+            return bit(operand.reg);
+        case Operand::Kind::addr:
+            return bit(operand.reg) | bit(operand.index);
+        default:
+            return 0;
+        }
+    }
+
+    // `xor r, r`: sets r to zero without reading it
+    static inline bool is_zeroing(const Instr& instr)
+    {
+        return instr.op == Op::xor_ && is_reg(instr.dst) && is_reg(instr.src, instr.dst.reg);
+    }
+
+    static inline RegMask address_reads(const Operand& operand)
+    {
+        return operand.kind == Operand::Kind::mem ? bit(operand.reg) : 0;
+    }
+
+    static inline RegMask uses(const Instr& instr)
+    {
+        switch (instr.op) {
+        case Op::mov:
+        case Op::lea:
+            return address_reads(instr.dst) | reads(instr.src);
+        case Op::push:
+            return reads(instr.dst) | bit(Reg::rsp);
+        case Op::pop:
+            return bit(Reg::rsp);
+        case Op::add:
+        case Op::sub:
+        case Op::imul:
+        case Op::inc:
+        case Op::dec:
+        case Op::neg:
+        case Op::shl:
+        case Op::sar:
+        case Op::shr:
+            return reads(instr.dst) | reads(instr.src);
+        case Op::xor_:
+            return is_zeroing(instr) ? 0 : reads(instr.dst) | reads(instr.src);
+        case Op::cqo:
+            return bit(Reg::rax);
+        case Op::idiv:
+            return reads(instr.dst) | bit(Reg::rax) | bit(Reg::rdx);
+        case Op::syscall:
+            // the only syscall generated is `exit`: number in rax, status in rdi
+            return bit(Reg::rax) | bit(Reg::rdi);
+        case Op::ret:
+            // JIT code returns the exit status to the host
+            return bit(Reg::rax) | bit(Reg::rsp);
+        }
+        return ~0u;
+    }
+
+    static inline RegMask defs(const Instr& instr)
+    {
+        const RegMask dst = is_reg(instr.dst) ? bit(instr.dst.reg) : 0;
+        switch (instr.op) {
+        case Op::mov:
+        case Op::lea:
+        case Op::add:
+        case Op::sub:
+        case Op::imul:
+        case Op::inc:
+        case Op::dec:
+        case Op::neg:
+        case Op::shl:
+        case Op::sar:
+        case Op::shr:
+        case Op::xor_:
+            return dst;
+        case Op::push:
+            return bit(Reg::rsp);
+        case Op::pop:
+            return dst | bit(Reg::rsp);
+        case Op::cqo:
+            return bit(Reg::rdx);
+        case Op::idiv:
+            return bit(Reg::rax) | bit(Reg::rdx);
+        case Op::syscall:
+            return bit(Reg::rax) | bit(Reg::rcx) | bit(Reg::r11);
+        case Op::ret:
+            return bit(Reg::rsp);
+        }
+        return 0;
+    }
+
+    static inline bool touches_stack(const Instr& instr)
+    {
+        return ((uses(instr) | defs(instr)) & bit(Reg::rsp)) != 0;
+    }
+
+    static inline bool fits_imm32(int64_t value)
+    {
+        return value >= INT32_MIN && value <= INT32_MAX;
+    }
+
+    inline void compute_liveness(const std::vector<Instr>& instrs)
+    {
+        m_live_after.resize(instrs.size());
+        RegMask live = 0;
+        for (size_t i = instrs.size(); i-- > 0;) {
+            m_live_after[i] = live;
+            live = (live & ~defs(instrs[i])) | uses(instrs[i]);
+        }
+    }
+
+    // `reg` can't be read after the instruction that was just appended (input index `i`)?
+    inline bool dead_after(size_t i, Reg reg) const
+    {
+        return reg != Reg::rsp && reg != Reg::rbp && (m_live_after[i] & bit(reg)) == 0;
+    }
+
+    inline bool enabled(PeepholeRule rule, size_t window) const
+    {
+        return m_options.enabled[static_cast<size_t>(rule)] && window <= m_options.window;
+    }
+
+    // Replace the last `window` output instructions with `replacement`.
+    inline void rewrite(PeepholeRule rule, size_t window, std::initializer_list<Instr> replacement)
+    {
+        m_out.resize(m_out.size() - window);
+        m_out.insert(m_out.end(), replacement.begin(), replacement.end());
+        m_applied[static_cast<size_t>(rule)]++;
+        m_removed[static_cast<size_t>(rule)] += window - replacement.size();
+        m_changed = true;
+    }
+
+    // Try every rule once against the tail of `m_out`; true if one fired.
+    inline bool apply_one(size_t i)
+    {
+        const size_t n = m_out.size();
+        if (n >= 2 && enabled(PeepholeRule::push_pop, 2)) {
+            const Instr& a = m_out[n - 2];
+            const Instr& b = m_out[n - 1];
+            if (a.op == Op::push && b.op == Op::pop && a.dst.kind != Operand::Kind::imm
+                && !(a.dst.kind == Operand::Kind::mem && a.dst.reg == Reg::rsp)) {
+                if (is_reg(a.dst, b.dst.reg)) {
+                    rewrite(PeepholeRule::push_pop, 2, {});
+                }
+                else {
+                    const Instr mov { .op = Op::mov, .dst = b.dst, .src = a.dst };
+                    rewrite(PeepholeRule::push_pop, 2, { mov });
+                }
+                return true;
+            }
+        }
+        if (n >= 3 && enabled(PeepholeRule::push_pop_around, 3)) {
+            const Instr& a = m_out[n - 3];
+            const Instr& mid = m_out[n - 2];
+            const Instr& c = m_out[n - 1];
+            // a pushed memory operand must not be overwritten by `mid` either
+            const bool mid_writes_mem = mid.op == Op::mov && mid.dst.kind == Operand::Kind::mem;
+            if (a.op == Op::push && (is_reg(a.dst) || (a.dst.kind == Operand::Kind::mem && !mid_writes_mem))
+                && c.op == Op::pop && !touches_stack(mid) && (defs(mid) & bit(a.dst.reg)) == 0) {
+                const Instr moved = mid;
+                if (is_reg(a.dst, c.dst.reg)) {
+                    rewrite(PeepholeRule::push_pop_around, 3, { moved });
+                }
+                else {
+                    const Instr mov { .op = Op::mov, .dst = c.dst, .src = a.dst };
+                    rewrite(PeepholeRule::push_pop_around, 3, { moved, mov });
+                }
+                return true;
+            }
+        }
+        if (n >= 2 && enabled(PeepholeRule::copy_prop, 2)) {
+            const Instr& a = m_out[n - 2];
+            const Instr& b = m_out[n - 1];
+            const Operand a_src = is_zeroing(a) ? Operand::imm(0) : a.src;
+            // a 32-bit `mov R, X` truncates X, unless X is an immediate it was chosen for
+            const bool full_width = b.dst.size == 8 && b.src.size == 8
+                && (a.dst.size == 8 || a_src.kind == Operand::Kind::imm);
+            if ((a.op == Op::mov || is_zeroing(a)) && is_reg(a.dst) && b.op == Op::mov && is_reg(b.src, a.dst.reg)
+                && full_width && !(b.dst.kind == Operand::Kind::mem && b.dst.reg == a.dst.reg)
+                && dead_after(i, a.dst.reg)) {
+                const bool mem_to_mem = b.dst.kind == Operand::Kind::mem && a_src.kind == Operand::Kind::mem;
+                const bool wide_imm_to_mem = b.dst.kind == Operand::Kind::mem && a_src.kind == Operand::Kind::imm
+                    && !fits_imm32(a_src.value);
+                if (!mem_to_mem && !wide_imm_to_mem) {
+                    const Instr mov = is_reg(b.dst) && a_src.kind == Operand::Kind::imm
+                        ? mov_imm(b.dst.reg, a_src.value)
+                        : Instr { .op = Op::mov, .dst = b.dst, .src = a_src };
+                    if (is_reg(mov.dst) && is_reg(mov.src, mov.dst.reg) && mov.op == Op::mov) {
+                        rewrite(PeepholeRule::copy_prop, 2, {});
+                    }
+                    else {
+                        rewrite(PeepholeRule::copy_prop, 2, { mov });
+                    }
+                    return true;
+                }
+            }
+        }
+        if (n >= 2 && enabled(PeepholeRule::imm_operand, 2)) {
+            const Instr& a = m_out[n - 2];
+            const Instr& b = m_out[n - 1];
+            if (a.op == Op::mov && is_reg(a.dst) && a.src.kind == Operand::Kind::imm && fits_imm32(a.src.value)
+                && (b.op == Op::add || b.op == Op::sub) && is_reg(b.dst) && b.dst.reg != a.dst.reg
+                && is_reg(b.src, a.dst.reg) && b.src.size == 8 && dead_after(i, a.dst.reg)) {
+                const Instr op { .op = b.op, .dst = b.dst, .src = a.src };
+                rewrite(PeepholeRule::imm_operand, 2, { op });
+                return true;
+            }
+        }
+        if (n >= 1 && enabled(PeepholeRule::dead_mov, 1)) {
+            const Instr& a = m_out[n - 1];
+            if ((a.op == Op::mov || is_zeroing(a)) && is_reg(a.dst) && dead_after(i, a.dst.reg)) {
+                rewrite(PeepholeRule::dead_mov, 1, {});
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline void run_pass(std::vector<Instr>& instrs)
+    {
+        compute_liveness(instrs);
+        m_out.clear();
+        m_out.reserve(instrs.size());
+        for (size_t i = 0; i < instrs.size(); i++) {
+            m_out.push_back(instrs[i]);
+            while (apply_one(i)) { }
+        }
+        instrs.swap(m_out);
+    }
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+// SHA-256 (FIPS 180-4), for content-addressing the compilation cache. Incremental: `update()` any number of times,
+// then `hex_digest()`.
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+class Sha256 {
+public:
+    inline void update(const void* data, size_t len)
+    {
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        m_total += len;
+        if (m_used > 0) {
+            const size_t take = std::min(len, BLOCK - m_used);
+            std::memcpy(m_block.data() + m_used, bytes, take);
+            m_used += take;
+            bytes += take;
+            len -= take;
+            if (m_used < BLOCK) {
+                return;
+            }
+            compress(m_block.data());
+            m_used = 0;
+        }
+        for (; len >= BLOCK; bytes += BLOCK, len -= BLOCK) {
+            compress(bytes);
+        }
+        std::memcpy(m_block.data(), bytes, len);
+        m_used = len;
+    }
+
+    inline void update(std::string_view text)
+    {
+        update(text.data(), text.size());
+    }
+
+    // Finishes the hash; the object can't be updated afterwards.
+    [[nodiscard]] inline std::array<uint8_t, 32> digest()
+    {
+        const uint64_t bits = m_total * 8;
+        const uint8_t pad = 0x80;
+        update(&pad, 1);
+        const uint8_t zero = 0;
+        while (m_used != BLOCK - 8) {
+            update(&zero, 1);
+        }
+        uint8_t length[8];
+        for (int i = 0; i < 8; i++) {
+            length[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        }
+        update(length, sizeof(length));
+
+        std::array<uint8_t, 32> out {};
+        for (size_t i = 0; i < 8; i++) {
+            for (size_t k = 0; k < 4; k++) {
+                out[i * 4 + k] = static_cast<uint8_t>(m_state[i] >> (24 - 8 * k));
+            }
+        }
+        return out;
+    }
+
+    [[nodiscard]] inline std::string hex_digest()
+    {
+        static constexpr char HEX[] = "0123456789abcdef";
+        std::string out;
+        for (const uint8_t byte : digest()) {
+            out.push_back(HEX[byte >> 4]);
+            out.push_back(HEX[byte & 0xF]);
+        }
+        return out;
+    }
+
+private:
+    static constexpr size_t BLOCK = 64;
+    static constexpr uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    std::array<uint32_t, 8> m_state = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    std::array<uint8_t, BLOCK> m_block {};
+    size_t m_used = 0;
+    uint64_t m_total = 0;
+
+    inline void compress(const uint8_t* block)
+    {
+        uint32_t w[64];
+        for (size_t i = 0; i < 16; i++) {
+            w[i] = static_cast<uint32_t>(block[i * 4]) << 24 | static_cast<uint32_t>(block[i * 4 + 1]) << 16
+                | static_cast<uint32_t>(block[i * 4 + 2]) << 8 | static_cast<uint32_t>(block[i * 4 + 3]);
+        }
+        for (size_t i = 16; i < 64; i++) {
+            const uint32_t s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 = std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+        uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+        for (size_t i = 0; i < 64; i++) {
+            const uint32_t s1 = std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25);
+            const uint32_t ch = (e & f) ^ (~e & g);
+            const uint32_t t1 = h + s1 + ch + K[i] + w[i];
+            const uint32_t s0 = std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22);
+            const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            const uint32_t t2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        m_state[0] += a;
+        m_state[1] += b;
+        m_state[2] += c;
+        m_state[3] += d;
+        m_state[4] += e;
+        m_state[5] += f;
+        m_state[6] += g;
+        m_state[7] += h;
+    }
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+// Read-only view of an input file. Regular files are `mmap`ed so the tokenizer can hand out `std::string_view`s
+// straight into the page cache: no copy of the whole source and no per-token heap allocation. Anything that can't be
+// mapped (pipes, `/dev/stdin`, ...) falls back to reading into an owned buffer.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+class SourceFile {
+public:
+    inline explicit SourceFile(const std::string& path)
+    {
+        m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_fd < 0) {
+            return;
+        }
+        struct stat st {};
+        if (fstat(m_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            m_size = static_cast<size_t>(st.st_size);
+            if (m_size == 0) {
+                m_ok = true;
+                return;
+            }
+            void* addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+            if (addr != MAP_FAILED) {
+                m_data = static_cast<const char*>(addr);
+                madvise(addr, m_size, MADV_SEQUENTIAL);
+                m_ok = true;
+                return;
+            }
+        }
+        // not mappable: read it the slow way
+        char chunk[64 * 1024];
+        ssize_t n;
+        while ((n = read(m_fd, chunk, sizeof(chunk))) > 0) {
+            m_fallback.append(chunk, static_cast<size_t>(n));
+        }
+        m_ok = n == 0;
+        m_data = m_fallback.data();
+        m_size = m_fallback.size();
+    }
+
+    // make it non-copyable
+    inline SourceFile(const SourceFile& other) = delete;
+
+    inline SourceFile operator=(const SourceFile& other) = delete;
+
+    inline ~SourceFile()
+    {
+        if (m_data != nullptr && m_data != m_fallback.data()) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    [[nodiscard]] inline bool ok() const
+    {
+        return m_ok;
+    }
+
+    // Valid for as long as this `SourceFile` lives; tokens and AST nodes point into it.
+    [[nodiscard]] inline std::string_view view() const
+    {
+        return { m_data, m_size };
+    }
+
+private:
+    int m_fd = -1;
+    bool m_ok = false;
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    std::string m_fallback;
+};
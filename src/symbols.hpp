@@ -0,0 +1,146 @@
+#pragma once
+
+// Identifier interning. The lexer turns every identifier into a `SymbolId`, dense and numbered in order of first
+// appearance, so the passes after it resolve names by indexing an array instead of hashing strings.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+
+using SymbolId = uint32_t;
+
+/**
+ * Open-addressing hash table of names, with the name bytes in an arena. The index (linear probing, power-of-two
+ * capacity, at most half full) keeps each name's id next to its hash, its length and its first eight bytes, so looking
+ * up a name of up to eight bytes reads one slot and nothing else, and growing never rehashes a string. On big programs
+ * a lookup is a cache miss either way; this makes it one instead of three.
+ */
+class SymbolTable {
+public:
+    inline SymbolTable() = default;
+
+    // make it non-copyable
+    inline SymbolTable(const SymbolTable& other) = delete;
+
+    inline SymbolTable operator=(const SymbolTable& other) = delete;
+
+    inline SymbolTable(SymbolTable&& other) noexcept = default;
+
+    inline SymbolTable& operator=(SymbolTable&& other) noexcept = default;
+
+    // The id of `name`, added if it's new.
+    inline SymbolId intern(std::string_view name)
+    {
+        if ((m_symbols.size() + 1) * 2 > m_index.size()) {
+            grow();
+        }
+        const uint64_t head = load_head(name);
+        // the low byte is the length (255: that long or longer), so equal fields mean equal lengths below 255
+        const uint32_t hash = (hash_name(name, head) & ~uint32_t { 0xff }) | std::min<uint32_t>(name.size(), 0xff);
+        const size_t mask = m_index.size() - 1;
+        for (size_t i = (hash >> 8) & mask;; i = (i + 1) & mask) {
+            Slot& slot = m_index[i];
+            if (slot.id == EMPTY) {
+                auto* bytes = static_cast<char*>(m_names.allocate(name.size(), 1));
+                std::memcpy(bytes, name.data(), name.size());
+                slot = { .head = head, .hash = hash, .id = static_cast<SymbolId>(m_symbols.size()) };
+                m_symbols.push_back({ .name = bytes, .size = static_cast<uint32_t>(name.size()) });
+                return slot.id;
+            }
+            if (slot.hash == hash && slot.head == head && (name.size() <= 8 || name == this->name(slot.id))) {
+                return slot.id;
+            }
+        }
+    }
+
+    [[nodiscard]] inline std::string_view name(SymbolId id) const
+    {
+        return { m_symbols[id].name, m_symbols[id].size };
+    }
+
+    [[nodiscard]] inline size_t size() const
+    {
+        return m_symbols.size();
+    }
+
+    // Forget every name; the arena and the index keep their memory for the next use.
+    inline void clear()
+    {
+        m_symbols.clear();
+        std::fill(m_index.begin(), m_index.end(), Slot {});
+        m_names.reset();
+    }
+
+private:
+    struct Symbol {
+        const char* name;
+        uint32_t size;
+    };
+
+    struct Slot {
+        uint64_t head = 0; // the first 8 bytes, zero-padded
+        uint32_t hash = 0;
+        SymbolId id = EMPTY;
+    };
+
+    static constexpr SymbolId EMPTY = UINT32_MAX;
+    static constexpr size_t MIN_CAPACITY = 64;
+
+    ArenaAllocator m_names { 4 * 1024 };
+    std::vector<Symbol> m_symbols; // by id
+    std::vector<Slot> m_index;
+
+    inline void grow()
+    {
+        std::vector<Slot> old(std::max(MIN_CAPACITY, m_index.size() * 2));
+        old.swap(m_index);
+        const size_t mask = m_index.size() - 1;
+        for (const Slot& slot : old) {
+            if (slot.id == EMPTY) {
+                continue;
+            }
+            size_t i = (slot.hash >> 8) & mask;
+            while (m_index[i].id != EMPTY) {
+                i = (i + 1) & mask;
+            }
+            m_index[i] = slot;
+        }
+    }
+
+    static inline uint64_t load_head(std::string_view name)
+    {
+        uint64_t head = 0;
+        std::memcpy(&head, name.data(), std::min<size_t>(name.size(), 8));
+        return head;
+    }
+
+    // Eight bytes at a time, starting with `head`; most identifiers are one or two words.
+    static inline uint32_t hash_name(std::string_view name, uint64_t head)
+    {
+        uint64_t h = 0x9e3779b97f4a7c15ull ^ name.size();
+        const auto mix = [&](uint64_t word) {
+            h = (h ^ word) * 0xbf58476d1ce4e5b9ull;
+            h ^= h >> 31;
+        };
+        mix(head);
+        size_t i = 8;
+        for (; i + 8 <= name.size(); i += 8) {
+            uint64_t word;
+            std::memcpy(&word, name.data() + i, 8);
+            mix(word);
+        }
+        if (i < name.size()) {
+            uint64_t word = 0;
+            std::memcpy(&word, name.data() + i, name.size() - i);
+            mix(word);
+        }
+        h *= 0x94d049bb133111ebull;
+        return static_cast<uint32_t>(h ^ (h >> 32));
+    }
+};
@@ -0,0 +1,211 @@
+#pragma once
+
+// Work-stealing thread pool. Every worker owns a deque of tasks: it pushes and pops at the back (most recently
+// submitted first, while its data is still in cache) and, when its own deque runs dry, steals from the front of the
+// others' (the oldest, usually largest, piece of work). Tasks submitted from outside the pool go to one shared queue
+// that everybody takes from the front, so they start in the order they were submitted.
+//
+// `wait()` doesn't just block: the calling thread runs queued tasks too, so a pool of N threads plus the caller keeps
+// N + 1 cores busy. Tasks may `submit()` more tasks, but only a thread outside the pool may `wait()`.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    // One worker per hardware thread, minus the caller.
+    [[nodiscard]] static inline size_t default_threads()
+    {
+        const size_t hw = std::thread::hardware_concurrency();
+        return hw > 1 ? hw - 1 : 0;
+    }
+
+    // `threads` workers besides the caller (0: the caller of `wait()` runs everything).
+    inline explicit ThreadPool(size_t threads = default_threads())
+    {
+        // queue 0 belongs to callers outside the pool, 1..threads to the workers
+        for (size_t i = 0; i <= threads; i++) {
+            m_queues.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 1; i <= threads; i++) {
+            m_workers.emplace_back([this, i] { worker_loop(i); });
+        }
+    }
+
+    // make it non-copyable
+    inline ThreadPool(const ThreadPool& other) = delete;
+
+    inline ThreadPool operator=(const ThreadPool& other) = delete;
+
+    inline ~ThreadPool()
+    {
+        wait();
+        {
+            std::lock_guard lock(m_sleep_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    // Threads that run tasks, the caller of `wait()` included.
+    [[nodiscard]] inline size_t size() const
+    {
+        return m_workers.size() + 1;
+    }
+
+    // Tasks a worker took from another worker's queue.
+    [[nodiscard]] inline size_t steals() const
+    {
+        return m_steals.load(std::memory_order_relaxed);
+    }
+
+    inline void submit(Task task)
+    {
+        const size_t index = t_pool == this ? t_queue_index : 0;
+        m_unfinished.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard lock(m_queues[index]->mutex);
+            m_queues[index]->tasks.push_back(std::move(task));
+            m_queued.fetch_add(1, std::memory_order_relaxed);
+        }
+        // a thread that found `m_queued == 0` is either still holding the sleep mutex, and will see the new count, or
+        // already waiting, and gets the notification
+        { std::lock_guard lock(m_sleep_mutex); }
+        m_wake.notify_one();
+    }
+
+    // Run tasks until everything submitted so far (and anything those tasks submit) has finished.
+    inline void wait()
+    {
+        while (m_unfinished.load(std::memory_order_acquire) > 0) {
+            if (std::optional<Task> task = take(0)) {
+                run(std::move(task.value()));
+                continue;
+            }
+            // the remaining tasks are running on other threads; sleep until one finishes or new work shows up
+            std::unique_lock lock(m_sleep_mutex);
+            m_wake.wait(lock, [this] { return m_queued > 0 || m_unfinished.load(std::memory_order_acquire) == 0; });
+        }
+    }
+
+    /**
+     * Run `fn(0)` ... `fn(count - 1)` on the pool and wait for all of them. If any throw, the exception of the lowest
+     * index is rethrown once all have finished, so the caller sees the error a serial loop would have hit first.
+     * Same restriction as `wait()`: not from inside one of this pool's tasks.
+     */
+    template <typename Fn>
+    inline void parallel_for(size_t count, const Fn& fn)
+    {
+        std::vector<std::exception_ptr> errors(count);
+        for (size_t i = 0; i < count; i++) {
+            submit([&fn, &errors, i] {
+                try {
+                    fn(i);
+                }
+                catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            });
+        }
+        wait();
+        for (const std::exception_ptr& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    static inline thread_local ThreadPool* t_pool = nullptr;
+    static inline thread_local size_t t_queue_index = 0;
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::atomic<size_t> m_unfinished = 0; // submitted but not yet finished
+    std::atomic<size_t> m_steals = 0;
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_wake;
+    // submitted but not yet started; changed together with the queue the task is in, under that queue's mutex
+    std::atomic<size_t> m_queued = 0;
+    bool m_stop = false;
+
+    inline void worker_loop(size_t index)
+    {
+        t_pool = this;
+        t_queue_index = index;
+        for (;;) {
+            if (std::optional<Task> task = take(index)) {
+                run(std::move(task.value()));
+                continue;
+            }
+            std::unique_lock lock(m_sleep_mutex);
+            m_wake.wait(lock, [this] { return m_queued > 0 || m_stop; });
+            if (m_stop && m_queued == 0) {
+                return;
+            }
+        }
+    }
+
+    // Own queue from the back (the shared queue 0 from the front), then everybody else's from the front.
+    inline std::optional<Task> take(size_t home)
+    {
+        std::optional<Task> task = pop(home, home != 0);
+        for (size_t k = 1; !task.has_value() && k < m_queues.size(); k++) {
+            const size_t index = (home + k) % m_queues.size();
+            task = pop(index, false);
+            if (task.has_value() && index != 0) {
+                m_steals.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        return task;
+    }
+
+    inline std::optional<Task> pop(size_t index, bool back)
+    {
+        Queue& queue = *m_queues[index];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            return {};
+        }
+        Task task;
+        if (back) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        m_queued.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+    }
+
+    inline void run(Task task)
+    {
+        task();
+        if (m_unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // wake anybody in `wait()`
+            { std::lock_guard lock(m_sleep_mutex); }
+            m_wake.notify_all();
+        }
+    }
+};
@@ -1,15 +1,33 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-enum class TokenType {
+#include "diagnostics.hpp"
+#include "lexer_scan.hpp"
+#include "metrics.hpp"
+#include "symbols.hpp"
+#include "thread_pool.hpp"
+
+enum class TokenType : uint8_t {
     exit,
     int_lit,
     semi,
     plus,
+    minus,
+    star,
+    fslash,
     open_paren,
     close_paren,
     ident,
@@ -17,104 +35,322 @@ enum class TokenType {
     eq,
 };
 
-struct Token {
-    TokenType type;
-    std::optional<std::string> value {};
+// Binding power of a binary operator token, or nothing if it isn't one. See docs/grammar.md.
+inline std::optional<int> bin_prec(TokenType type)
+{
+    switch (type) {
+    case TokenType::plus:
+    case TokenType::minus:
+        return 0;
+    case TokenType::star:
+    case TokenType::fslash:
+        return 1;
+    default:
+        return {};
+    }
+}
+
+// 8-byte per-token record. `offset` is where the token starts in the source. `data` is the length of the token's text,
+// except for `int_lit` tokens where it's the index of the already decoded value in `TokenStream::int_lits`, and `ident`
+// tokens where it's the name's id in `TokenStream::symbols`.
+struct TokenRecord {
+    uint32_t offset;
+    uint32_t data;
 };
 
+// `std::allocator`, except that value-initialization (`resize(n)`) leaves the new elements uninitialized: a buffer that
+// is about to be overwritten anyway isn't zeroed first, which for a large one means touching every page twice.
+template <typename T>
+struct UninitializedAllocator : std::allocator<T> {
+    template <typename U>
+    struct rebind {
+        using other = UninitializedAllocator<U>;
+    };
+
+    UninitializedAllocator() = default;
+
+    template <typename U>
+    inline UninitializedAllocator(const UninitializedAllocator<U>&) noexcept
+    {
+    }
+
+    template <typename U>
+    inline void construct(U* p) noexcept
+    {
+        static_assert(std::is_trivially_default_constructible_v<U>);
+        ::new (static_cast<void*>(p)) U;
+    }
+
+    template <typename U, typename... Args>
+    inline void construct(U* p, Args&&... args)
+    {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+template <typename T>
+using TokenBuffer = std::vector<T, UninitializedAllocator<T>>;
+
+// Structure-of-arrays token stream: one byte of kind plus one `TokenRecord` per token. Views returned by `text()`
+// point into the source buffer handed to `Tokenizer`, which must outlive the stream (and the AST), or for identifiers
+// into `symbols`.
+struct TokenStream {
+    std::string_view src {};
+    TokenBuffer<TokenType> kinds {};
+    TokenBuffer<TokenRecord> records {};
+    TokenBuffer<int64_t> int_lits {};
+    SymbolTable symbols {};
+
+    [[nodiscard]] inline size_t size() const
+    {
+        return kinds.size();
+    }
+
+    [[nodiscard]] inline std::string_view text(size_t index) const
+    {
+        if (kinds[index] == TokenType::ident) {
+            return symbols.name(records[index].data);
+        }
+        return src.substr(records[index].offset, records[index].data);
+    }
+
+    [[nodiscard]] inline int64_t int_value(size_t index) const
+    {
+        return int_lits[records[index].data];
+    }
+
+    inline void push(TokenType type, const char* begin, size_t len)
+    {
+        kinds.push_back(type);
+        records.push_back({ .offset = static_cast<uint32_t>(begin - src.data()), .data = static_cast<uint32_t>(len) });
+    }
+};
+
+enum class CharClass : uint8_t {
+    invalid,
+    space,
+    alpha, // starts an identifier or keyword
+    digit, // starts an int literal
+    punct, // single-byte token, see `CharInfo::punct`
+};
+
+struct CharInfo {
+    CharClass cls = CharClass::invalid;
+    TokenType punct = TokenType::exit;
+};
+
+// One entry per byte value, so classifying a byte is a single load instead of `isalpha`/`isdigit`/`isspace` plus a
+// chain of comparisons.
+inline constexpr std::array<CharInfo, 256> CHAR_TABLE = [] {
+    std::array<CharInfo, 256> table {};
+    for (int c = 0; c < 256; c++) {
+        const auto b = static_cast<uint8_t>(c);
+        if (is_space_byte(b)) {
+            table[c].cls = CharClass::space;
+        }
+        else if (is_alpha_byte(b)) {
+            table[c].cls = CharClass::alpha;
+        }
+        else if (is_digit_byte(b)) {
+            table[c].cls = CharClass::digit;
+        }
+    }
+    const auto punct = [&](char c, TokenType type) {
+        table[static_cast<uint8_t>(c)] = { .cls = CharClass::punct, .punct = type };
+    };
+    punct('(', TokenType::open_paren);
+    punct(')', TokenType::close_paren);
+    punct(';', TokenType::semi);
+    punct('=', TokenType::eq);
+    punct('+', TokenType::plus);
+    punct('-', TokenType::minus);
+    punct('*', TokenType::star);
+    punct('/', TokenType::fslash);
+    return table;
+}();
+
 class Tokenizer {
 public:
-    inline explicit Tokenizer(std::string src)
-        : m_src(std::move(src))
+    inline explicit Tokenizer(std::string_view src, LexerIsa isa = detect_lexer_isa())
+        : m_src(src)
+        , m_scan(lexer_scanners(isa))
     {
     }
 
-    inline std::vector<Token> tokenize()
+    inline TokenStream tokenize()
     {
-        std::vector<Token> tokens;
-        std::string buf;
+        check_size();
+        TokenStream tokens { .src = m_src };
+        lex(tokens, m_src.data(), m_src.data() + m_src.size());
+        return tokens;
+    }
 
-        while (peek().has_value()) {
-            if (std::isalpha(peek().value())) {
-                buf.push_back(consume());
-                while (peek().has_value() && std::isalnum(peek().value())) {
-                    buf.push_back(consume());
+    /**
+     * Same tokens as `tokenize()`, bit for bit, lexed on `pool`. The source is cut into chunks right after a `;`
+     * (a `;` is always a token of its own: there are no strings or comments, and identifiers and numbers are
+     * alphanumeric), so every chunk starts at a token boundary and lexes exactly as it would have in one pass. Each
+     * chunk gets its own token buffers and symbol table; they are then copied into one stream in order, with every
+     * chunk's `int_lit` indices shifted past the literals of the chunks before it and its symbol ids mapped to ids in
+     * the merged table. Merging the tables chunk by chunk numbers the names in order of first appearance, as one pass
+     * does. On an error, the first one in the source is thrown.
+     *
+     * Chunks are at least `PARALLEL_MIN_BYTES`, so a source too small for two of them is lexed serially: there,
+     * handing out the work would cost more than it saves.
+     */
+    inline TokenStream tokenize_parallel(ThreadPool& pool)
+    {
+        check_size();
+        const std::vector<const char*> cuts = chunk_cuts(pool.size() * 4);
+        if (cuts.size() <= 2) {
+            return tokenize();
+        }
+        const size_t chunks = cuts.size() - 1;
+        std::vector<TokenStream> parts(chunks);
+        pool.parallel_for(chunks, PhaseTimer::counted([&](size_t i) {
+            parts[i].src = m_src;
+            // about one token per 3 bytes in typical code; growing past it is fine
+            const auto bytes = static_cast<size_t>(cuts[i + 1] - cuts[i]);
+            parts[i].kinds.reserve(bytes / 3);
+            parts[i].records.reserve(bytes / 3);
+            lex(parts[i], cuts[i], cuts[i + 1]);
+        }));
+
+        std::vector<size_t> token_base(chunks + 1, 0);
+        std::vector<size_t> int_base(chunks + 1, 0);
+        for (size_t i = 0; i < chunks; i++) {
+            token_base[i + 1] = token_base[i] + parts[i].size();
+            int_base[i + 1] = int_base[i] + parts[i].int_lits.size();
+        }
+        TokenStream tokens { .src = m_src };
+        std::vector<std::vector<SymbolId>> symbol_map(chunks);
+        for (size_t i = 0; i < chunks; i++) {
+            const SymbolTable& symbols = parts[i].symbols;
+            symbol_map[i].resize(symbols.size());
+            for (SymbolId id = 0; id < symbols.size(); id++) {
+                symbol_map[i][id] = tokens.symbols.intern(symbols.name(id));
+            }
+        }
+        // not zeroed: the copies below write every element, and fault the pages in on all threads at once
+        tokens.kinds.resize(token_base[chunks]);
+        tokens.records.resize(token_base[chunks]);
+        tokens.int_lits.resize(int_base[chunks]);
+        pool.parallel_for(chunks, PhaseTimer::counted([&](size_t i) {
+            const TokenStream& part = parts[i];
+            std::copy(part.kinds.begin(), part.kinds.end(), tokens.kinds.begin() + token_base[i]);
+            std::copy(part.int_lits.begin(), part.int_lits.end(), tokens.int_lits.begin() + int_base[i]);
+            TokenRecord* out = tokens.records.data() + token_base[i];
+            const auto shift = static_cast<uint32_t>(int_base[i]);
+            const std::vector<SymbolId>& symbols = symbol_map[i];
+            for (size_t k = 0; k < part.size(); k++) {
+                out[k] = part.records[k];
+                if (part.kinds[k] == TokenType::int_lit) {
+                    out[k].data += shift;
                 }
-                if (buf == "exit") {
-                    tokens.push_back({ .type = TokenType::exit });
-                    buf.clear();
+                else if (part.kinds[k] == TokenType::ident) {
+                    out[k].data = symbols[out[k].data];
                 }
-                else if (buf == "let") {
-                    tokens.push_back({ .type = TokenType::let });
-                    buf.clear();
+            }
+            // free each chunk's buffers as soon as they're copied, not all at the end
+            parts[i] = TokenStream();
+        }));
+        return tokens;
+    }
+
+    // Below this, `tokenize_parallel` lexes serially; also the smallest chunk it makes.
+    static constexpr size_t PARALLEL_MIN_BYTES = 1 << 20;
+
+private:
+    const std::string_view m_src;
+    const LexerScanners m_scan;
+
+    inline void check_size() const
+    {
+        if (m_src.size() > UINT32_MAX) {
+            throw CompileError("Source too large: " + std::to_string(m_src.size()) + " bytes (max "
+                               + std::to_string(UINT32_MAX) + ")");
+        }
+    }
+
+    // Lex `[p, end)` into `tokens`. Offsets are from the start of the whole source.
+    inline void lex(TokenStream& tokens, const char* p, const char* const end) const
+    {
+        const char* const begin = m_src.data();
+        while (p < end) {
+            const CharInfo info = CHAR_TABLE[static_cast<uint8_t>(*p)];
+            switch (info.cls) {
+            case CharClass::space:
+                p = m_scan.skip_space(p + 1, end);
+                break;
+            case CharClass::alpha: {
+                const char* word_end = m_scan.skip_alnum(p + 1, end);
+                const std::string_view word(p, static_cast<size_t>(word_end - p));
+                if (word == "exit") {
+                    tokens.push(TokenType::exit, p, word.size());
                 }
-                else {
-                    tokens.push_back({ .type = TokenType::ident, .value = buf });
-                    buf.clear();
+                else if (word == "let") {
+                    tokens.push(TokenType::let, p, word.size());
                 }
-            }
-            else if (std::isdigit(peek().value())) {
-                buf.push_back(consume());
-                while (peek().has_value() && std::isdigit(peek().value())) {
-                    buf.push_back(consume());
+                else {
+                    tokens.kinds.push_back(TokenType::ident);
+                    tokens.records.push_back(
+                        { .offset = static_cast<uint32_t>(p - begin), .data = tokens.symbols.intern(word) });
                 }
-                tokens.push_back({ .type = TokenType::int_lit, .value = buf });
-                buf.clear();
-            }
-            else if (peek().value() == '(') {
-                consume();
-                tokens.push_back({ .type = TokenType::open_paren });
-            }
-            else if (peek().value() == ')') {
-                consume();
-                tokens.push_back({ .type = TokenType::close_paren });
-            }
-            else if (peek().value() == ';') {
-                consume();
-                tokens.push_back({ .type = TokenType::semi });
-            }
-            else if (peek().value() == '=') {
-                consume();
-                tokens.push_back({ .type = TokenType::eq });
-            }
-            else if (peek().value() == '+') {
-                consume();
-                tokens.push_back({ .type = TokenType::plus });
+                p = word_end;
+                break;
             }
-            else if (std::isspace(peek().value())) {
-                consume();
+            case CharClass::digit: {
+                const char* digits_end = m_scan.skip_digits(p + 1, end);
+                tokens.kinds.push_back(TokenType::int_lit);
+                tokens.records.push_back({ .offset = static_cast<uint32_t>(p - begin),
+                                           .data = static_cast<uint32_t>(tokens.int_lits.size()) });
+                tokens.int_lits.push_back(decode_int_lit(p, digits_end, begin));
+                p = digits_end;
+                break;
             }
-            else {
-                std::cerr << "You messed up! `else`" << std::endl;
-                exit(EXIT_FAILURE);
+            case CharClass::punct:
+                tokens.push(info.punct, p, 1);
+                p++;
+                break;
+            case CharClass::invalid:
+                throw CompileError("You messed up! `else`", static_cast<size_t>(p - begin));
             }
         }
-
-        m_index = 0;
-
-        return tokens;
     }
 
-private:
-    const std::string m_src;
-    size_t m_index = 0;
-
-    [[nodiscard]] inline std::optional<char> peek(int offset = 0) const
+    // Chunk boundaries: the start of the source, up to `max_chunks - 1` cuts just after a `;`, the end.
+    [[nodiscard]] inline std::vector<const char*> chunk_cuts(size_t max_chunks) const
     {
-        if (m_index + offset >= m_src.length()) {
-            return {};
-        }
-        else {
-            return m_src.at(m_index + offset);
+        const char* const begin = m_src.data();
+        const char* const end = begin + m_src.size();
+        const size_t chunks = std::min(max_chunks, m_src.size() / PARALLEL_MIN_BYTES);
+        std::vector<const char*> cuts { begin };
+        for (size_t i = 1; i < chunks; i++) {
+            const char* from = std::max(begin + m_src.size() / chunks * i, cuts.back());
+            const auto* semi = static_cast<const char*>(std::memchr(from, ';', static_cast<size_t>(end - from)));
+            if (semi == nullptr) {
+                break;
+            }
+            if (semi + 1 < end) {
+                cuts.push_back(semi + 1);
+            }
         }
+        cuts.push_back(end);
+        return cuts;
     }
 
-    inline char consume()
+    // Decimal literal -> 64-bit value, once, at lex time. Anything up to 2^64 - 1 is accepted (and wraps into
+    // `int64_t`), which is what the assembler accepted when literals were passed through as text.
+    static inline int64_t decode_int_lit(const char* begin, const char* end, const char* src)
     {
-        char c = m_src.at(m_index);
-        m_index++;
-
-        return c;
+        uint64_t value = 0;
+        for (const char* p = begin; p < end; p++) {
+            if (__builtin_mul_overflow(value, 10, &value)
+                || __builtin_add_overflow(value, static_cast<uint64_t>(*p - '0'), &value)) {
+                throw CompileError("Integer literal out of range: " + std::string(begin, end),
+                                   static_cast<size_t>(begin - src));
+            }
+        }
+        return static_cast<int64_t>(value);
     }
 };
 
@@ -0,0 +1,115 @@
+#pragma once
+
+// Interpreter for `Bytecode` (`--vm`): no assembler, no executable memory, no child process.
+//
+// Dispatch is threaded with computed gotos (`goto *label`) on GCC and Clang: every handler ends with its own indirect
+// jump to the next one, which predicts much better than one shared `switch` jump. Other compilers, or builds with
+// `IO_VM_NO_COMPUTED_GOTO` defined, get the portable `switch` loop. Both run the same handler bodies.
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+#include "bytecode.hpp"
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(IO_VM_NO_COMPUTED_GOTO)
+#define IO_VM_COMPUTED_GOTO 1
+#endif
+
+struct VmResult {
+    bool trapped = false; // division by zero or INT64_MIN / -1, where native code would get SIGFPE
+    int64_t value = 0; // what the program passed to `exit`
+};
+
+class Vm {
+public:
+    // `bc` must have passed `Bytecode::verify()`.
+    inline explicit Vm(const Bytecode& bc)
+        : m_bc(bc)
+        , m_regs(bc.reg_count, 0)
+    {
+    }
+
+    inline VmResult run()
+    {
+        const uint32_t* pc = m_bc.code.data();
+        const int64_t* consts = m_bc.consts.data();
+        int64_t* r = m_regs.data();
+
+#ifdef IO_VM_COMPUTED_GOTO
+        // indexed by `BcOp`
+        static const void* const LABELS[] = { &&op_imm, &&op_mov, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_exit };
+        static_assert(std::size(LABELS) == static_cast<size_t>(BcOp::count));
+#define IO_VM_CASE(name) op_##name
+#define IO_VM_NEXT(words)                                                                                              \
+    pc += (words);                                                                                                     \
+    goto* LABELS[*pc]
+        goto* LABELS[*pc];
+#else
+#define IO_VM_CASE(name) case BcOp::name
+#define IO_VM_NEXT(words)                                                                                              \
+    pc += (words);                                                                                                     \
+    continue
+#endif
+
+        for (;;) {
+#ifndef IO_VM_COMPUTED_GOTO
+            switch (static_cast<BcOp>(*pc)) {
+#endif
+            IO_VM_CASE(imm) :
+            {
+                r[pc[1]] = consts[pc[2]];
+                IO_VM_NEXT(3);
+            }
+            IO_VM_CASE(mov) :
+            {
+                r[pc[1]] = r[pc[2]];
+                IO_VM_NEXT(3);
+            }
+            // add/sub/mul wrap around like the native instructions
+            IO_VM_CASE(add) :
+            {
+                r[pc[1]] = static_cast<int64_t>(static_cast<uint64_t>(r[pc[2]]) + static_cast<uint64_t>(r[pc[3]]));
+                IO_VM_NEXT(4);
+            }
+            IO_VM_CASE(sub) :
+            {
+                r[pc[1]] = static_cast<int64_t>(static_cast<uint64_t>(r[pc[2]]) - static_cast<uint64_t>(r[pc[3]]));
+                IO_VM_NEXT(4);
+            }
+            IO_VM_CASE(mul) :
+            {
+                r[pc[1]] = static_cast<int64_t>(static_cast<uint64_t>(r[pc[2]]) * static_cast<uint64_t>(r[pc[3]]));
+                IO_VM_NEXT(4);
+            }
+            IO_VM_CASE(div) :
+            {
+                const int64_t lhs = r[pc[2]];
+                const int64_t rhs = r[pc[3]];
+                if (rhs == 0 || (lhs == std::numeric_limits<int64_t>::min() && rhs == -1)) {
+                    return { .trapped = true };
+                }
+                r[pc[1]] = lhs / rhs;
+                IO_VM_NEXT(4);
+            }
+            IO_VM_CASE(exit) :
+            {
+                return { .value = r[pc[1]] };
+            }
+#ifndef IO_VM_COMPUTED_GOTO
+            case BcOp::count:
+                break;
+            }
+            return { .trapped = true }; // unreachable for verified code
+#endif
+        }
+#undef IO_VM_CASE
+#undef IO_VM_NEXT
+    }
+
+private:
+    const Bytecode& m_bc;
+    std::vector<int64_t> m_regs;
+};
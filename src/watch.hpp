@@ -0,0 +1,85 @@
+#pragma once
+
+// Change notification for `--watch`, on inotify. The directory is watched rather than the file itself: editors that
+// save by writing a new file and renaming it over the old one would otherwise end the watch after the first save.
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+
+class FileWatcher {
+public:
+    inline explicit FileWatcher(const std::string& path)
+    {
+        const std::filesystem::path file(path);
+        m_name = file.filename().string();
+        const std::string dir = file.parent_path().empty() ? "." : file.parent_path().string();
+        m_fd = inotify_init1(IN_CLOEXEC);
+        m_ok = m_fd >= 0 && inotify_add_watch(m_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0;
+    }
+
+    // make it non-copyable
+    inline FileWatcher(const FileWatcher& other) = delete;
+
+    inline FileWatcher operator=(const FileWatcher& other) = delete;
+
+    inline ~FileWatcher()
+    {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    [[nodiscard]] inline bool ok() const
+    {
+        return m_ok;
+    }
+
+    // Block until the file has been written or replaced; false if watching failed.
+    inline bool wait()
+    {
+        while (!read_events()) {
+            if (!m_ok) {
+                return false;
+            }
+        }
+        // an editor's save can be several events (write, then rename, ...): let them settle and build once
+        pollfd fd { .fd = m_fd, .events = POLLIN, .revents = 0 };
+        while (poll(&fd, 1, SETTLE_MS) > 0) {
+            read_events();
+        }
+        return m_ok;
+    }
+
+private:
+    static constexpr int SETTLE_MS = 20;
+
+    int m_fd = -1;
+    bool m_ok = false;
+    std::string m_name;
+
+    // Read one batch of events; true if one of them is about our file.
+    inline bool read_events()
+    {
+        alignas(inotify_event) char buffer[4096];
+        const ssize_t n = read(m_fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            m_ok = n < 0 && errno == EINTR;
+            return false;
+        }
+        bool changed = false;
+        for (size_t offset = 0; offset < static_cast<size_t>(n);) {
+            const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            if (event->len > 0 && m_name == event->name) {
+                changed = true;
+            }
+            offset += sizeof(inotify_event) + event->len;
+        }
+        return changed;
+    }
+};
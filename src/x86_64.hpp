@@ -0,0 +1,594 @@
+#pragma once
+
+// Instruction-level representation of what `Generator` emits, plus an encoder that turns it straight into x86-64
+// machine code. The text printer (`write_nasm`) renders the same instructions for the optional `.asm` debug output, so
+// both paths always agree on what was generated.
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "output.hpp"
+
+enum class Reg : uint8_t { rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15 };
+
+enum class Op : uint8_t {
+    mov,
+    lea,
+    push,
+    pop,
+    add,
+    sub,
+    imul,
+    inc,
+    dec,
+    neg,
+    shl,
+    sar,
+    shr,
+    xor_, // `xor` is a C++ keyword
+    cqo,
+    idiv,
+    syscall,
+    ret,
+};
+
+struct Operand {
+    enum class Kind : uint8_t {
+        none,
+        reg,
+        imm,
+        mem,
+        addr, // `[base + index*scale + disp]` as an address, for `lea`
+    };
+
+    Kind kind = Kind::none;
+    Reg reg = Reg::rax; // register, or base register of a memory operand or address
+    int64_t value = 0; // immediate, or displacement of a memory operand or address
+    Reg index = Reg::rax; // of an address
+    uint8_t scale = 1;
+    uint8_t size = 8; // of a register: 8, or 4 for its low half (writing that zeroes the upper half)
+
+    static Operand r(Reg reg)
+    {
+        return { .kind = Kind::reg, .reg = reg };
+    }
+
+    static Operand r32(Reg reg)
+    {
+        return { .kind = Kind::reg, .reg = reg, .size = 4 };
+    }
+
+    static Operand imm(int64_t value)
+    {
+        return { .kind = Kind::imm, .value = value };
+    }
+
+    // QWORD [base + disp]
+    static Operand mem(Reg base, int32_t disp)
+    {
+        return { .kind = Kind::mem, .reg = base, .value = disp };
+    }
+
+    // [base + index*scale]; scale is 1, 2, 4 or 8 and index is not rsp
+    static Operand addr(Reg base, Reg index, uint8_t scale)
+    {
+        return { .kind = Kind::addr, .reg = base, .index = index, .scale = scale };
+    }
+};
+
+struct Instr {
+    Op op;
+    Operand dst {};
+    Operand src {};
+};
+
+/**
+ * The shortest `mov reg, value`: `xor r32, r32` for 0, the zero-extending `mov r32, imm32` up to 2^32 - 1, the
+ * sign-extended imm32 form for small negative values and `movabs` for the rest (2-3, 5-6, 7 and 10 bytes). Generated
+ * code never reads the flags, so the `xor` clobbering them is fine.
+ */
+inline Instr mov_imm(Reg reg, int64_t value)
+{
+    if (value == 0) {
+        return { .op = Op::xor_, .dst = Operand::r32(reg), .src = Operand::r32(reg) };
+    }
+    if (value > 0 && value <= UINT32_MAX) {
+        return { .op = Op::mov, .dst = Operand::r32(reg), .src = Operand::imm(value) };
+    }
+    return { .op = Op::mov, .dst = Operand::r(reg), .src = Operand::imm(value) };
+}
+
+inline const char* reg_name(Reg reg)
+{
+    static const char* names[] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                   "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15" };
+    return names[static_cast<size_t>(reg)];
+}
+
+inline const char* reg32_name(Reg reg)
+{
+    static const char* names[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi",  "edi",
+                                   "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+    return names[static_cast<size_t>(reg)];
+}
+
+inline const char* operand_reg_name(const Operand& operand)
+{
+    return operand.size == 4 ? reg32_name(operand.reg) : reg_name(operand.reg);
+}
+
+inline const char* op_name(Op op)
+{
+    switch (op) {
+    case Op::mov:
+        return "mov";
+    case Op::lea:
+        return "lea";
+    case Op::push:
+        return "push";
+    case Op::pop:
+        return "pop";
+    case Op::add:
+        return "add";
+    case Op::sub:
+        return "sub";
+    case Op::imul:
+        return "imul";
+    case Op::inc:
+        return "inc";
+    case Op::dec:
+        return "dec";
+    case Op::neg:
+        return "neg";
+    case Op::shl:
+        return "shl";
+    case Op::sar:
+        return "sar";
+    case Op::shr:
+        return "shr";
+    case Op::xor_:
+        return "xor";
+    case Op::cqo:
+        return "cqo";
+    case Op::idiv:
+        return "idiv";
+    case Op::syscall:
+        return "syscall";
+    case Op::ret:
+        return "ret";
+    }
+    return "?";
+}
+
+template <typename Output>
+inline void write_operand(Output& out, const Operand& operand)
+{
+    switch (operand.kind) {
+    case Operand::Kind::none:
+        break;
+    case Operand::Kind::reg:
+        out.write(operand_reg_name(operand));
+        break;
+    case Operand::Kind::imm:
+        out.write_int(operand.value);
+        break;
+    case Operand::Kind::mem:
+    case Operand::Kind::addr:
+        out.write(operand.kind == Operand::Kind::mem ? "QWORD [" : "[");
+        out.write(reg_name(operand.reg));
+        if (operand.kind == Operand::Kind::addr) {
+            out.write(" + ");
+            out.write(reg_name(operand.index));
+            out.put('*');
+            out.write_int(operand.scale);
+        }
+        if (operand.value > 0) {
+            out.write(" + ");
+            out.write_int(operand.value);
+        }
+        else if (operand.value < 0) {
+            out.write(" - ");
+            out.write_int(-operand.value);
+        }
+        out.put(']');
+        break;
+    }
+}
+
+// One instruction as NASM text, indented, without the newline.
+template <typename Output>
+inline void write_instr(Output& out, const Instr& instr)
+{
+    out.write("    ");
+    out.write(op_name(instr.op));
+    if (instr.dst.kind != Operand::Kind::none) {
+        out.put(' ');
+        write_operand(out, instr.dst);
+    }
+    if (instr.src.kind != Operand::Kind::none) {
+        out.write(", ");
+        write_operand(out, instr.src);
+    }
+}
+
+// Render a program for `nasm -felf64` into an `OutputFile` or `StringOutput`.
+template <typename Output>
+inline void write_nasm(Output& out, const std::vector<Instr>& instrs)
+{
+    out.write("global _start\n_start:\n");
+    for (const Instr& instr : instrs) {
+        write_instr(out, instr);
+        out.put('\n');
+    }
+}
+
+// The same text as `write_nasm`, for diagnostics and debugging.
+inline std::ostream& operator<<(std::ostream& out, const Operand& operand)
+{
+    StringOutput text;
+    write_operand(text, operand);
+    return out << text.take();
+}
+
+inline std::ostream& operator<<(std::ostream& out, const Instr& instr)
+{
+    StringOutput text;
+    write_instr(text, instr);
+    return out << text.take();
+}
+
+/**
+ * Encodes `Instr`s into raw x86-64 machine code. Only the forms `Generator` actually produces are supported; anything
+ * else is a compiler bug, not a user error.
+ */
+class Encoder {
+public:
+    inline void encode(const Instr& instr)
+    {
+        const Operand& dst = instr.dst;
+        const Operand& src = instr.src;
+        switch (instr.op) {
+        case Op::mov:
+            if (dst.kind == Operand::Kind::reg && dst.size == 4 && src.kind == Operand::Kind::imm) {
+                if (src.value < 0 || src.value > UINT32_MAX) {
+                    break;
+                }
+                // B8+r id, zero-extended into the full register
+                rex(false, 0, dst.reg);
+                byte(0xB8 + low3(dst.reg));
+                imm32(static_cast<int32_t>(static_cast<uint32_t>(src.value)));
+                return;
+            }
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::imm) {
+                if (src.value >= INT32_MIN && src.value <= INT32_MAX) {
+                    // REX.W C7 /0 id (sign-extended imm32)
+                    rex(true, 0, dst.reg);
+                    byte(0xC7);
+                    modrm_reg(0, dst.reg);
+                    imm32(static_cast<int32_t>(src.value));
+                }
+                else {
+                    // REX.W B8+r io
+                    rex(true, 0, dst.reg);
+                    byte(0xB8 + low3(dst.reg));
+                    imm64(src.value);
+                }
+                return;
+            }
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::reg) {
+                return rr(0x89, dst.reg, src.reg);
+            }
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::mem) {
+                return rm(0x8B, dst.reg, src);
+            }
+            if (dst.kind == Operand::Kind::mem && src.kind == Operand::Kind::reg) {
+                return rm(0x89, src.reg, dst);
+            }
+            if (dst.kind == Operand::Kind::mem && src.kind == Operand::Kind::imm && src.value >= INT32_MIN
+                && src.value <= INT32_MAX) {
+                // REX.W C7 /0 id
+                rex(true, 0, dst.reg);
+                byte(0xC7);
+                mem(0, dst);
+                imm32(static_cast<int32_t>(src.value));
+                return;
+            }
+            break;
+        case Op::lea:
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::addr) {
+                // REX.W 8D /r with a SIB byte
+                return lea(dst.reg, src);
+            }
+            break;
+        case Op::push:
+            if (dst.kind == Operand::Kind::reg) {
+                rex(false, 0, dst.reg);
+                byte(0x50 + low3(dst.reg));
+                return;
+            }
+            if (dst.kind == Operand::Kind::mem) {
+                // FF /6, operand size defaults to 64 bits
+                rex(false, 0, dst.reg);
+                byte(0xFF);
+                mem(6, dst);
+                return;
+            }
+            break;
+        case Op::pop:
+            if (dst.kind == Operand::Kind::reg) {
+                rex(false, 0, dst.reg);
+                byte(0x58 + low3(dst.reg));
+                return;
+            }
+            break;
+        case Op::add:
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::reg) {
+                return rr(0x01, dst.reg, src.reg);
+            }
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::imm) {
+                return ri(0, dst.reg, src.value);
+            }
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::mem) {
+                return rm(0x03, dst.reg, src);
+            }
+            break;
+        case Op::sub:
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::reg) {
+                return rr(0x29, dst.reg, src.reg);
+            }
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::imm) {
+                return ri(5, dst.reg, src.value);
+            }
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::mem) {
+                return rm(0x2B, dst.reg, src);
+            }
+            break;
+        case Op::imul:
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::reg) {
+                // REX.W 0F AF /r, destination in ModRM.reg
+                rex(true, static_cast<uint8_t>(dst.reg), src.reg);
+                byte(0x0F);
+                byte(0xAF);
+                modrm_reg(static_cast<uint8_t>(dst.reg), src.reg);
+                return;
+            }
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::mem) {
+                // REX.W 0F AF /r
+                rex(true, static_cast<uint8_t>(dst.reg), src.reg);
+                byte(0x0F);
+                byte(0xAF);
+                mem(static_cast<uint8_t>(dst.reg), src);
+                return;
+            }
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::imm && src.value >= INT32_MIN
+                && src.value <= INT32_MAX) {
+                // `imul r, r, imm`: REX.W 6B /r ib when it fits in a byte, else 69 /r id
+                const bool imm8 = src.value >= INT8_MIN && src.value <= INT8_MAX;
+                rex(true, static_cast<uint8_t>(dst.reg), dst.reg);
+                byte(imm8 ? 0x6B : 0x69);
+                modrm_reg(static_cast<uint8_t>(dst.reg), dst.reg);
+                if (imm8) {
+                    byte(static_cast<uint8_t>(static_cast<int8_t>(src.value)));
+                }
+                else {
+                    imm32(static_cast<int32_t>(src.value));
+                }
+                return;
+            }
+            break;
+        case Op::inc:
+        case Op::dec:
+            if (dst.kind == Operand::Kind::reg) {
+                // REX.W FF /0, /1
+                rex(true, 0, dst.reg);
+                byte(0xFF);
+                modrm_reg(instr.op == Op::inc ? 0 : 1, dst.reg);
+                return;
+            }
+            break;
+        case Op::neg:
+            if (dst.kind == Operand::Kind::reg) {
+                // REX.W F7 /3
+                rex(true, 0, dst.reg);
+                byte(0xF7);
+                modrm_reg(3, dst.reg);
+                return;
+            }
+            break;
+        case Op::shl:
+        case Op::sar:
+        case Op::shr:
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::imm && src.value >= 1 && src.value <= 63) {
+                return shift(instr.op == Op::shl ? 4 : instr.op == Op::sar ? 7 : 5, dst.reg, src.value);
+            }
+            break;
+        case Op::xor_:
+            if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::reg && dst.size == src.size) {
+                return rr(0x31, dst.reg, src.reg, dst.size == 8);
+            }
+            break;
+        case Op::cqo:
+            byte(0x48);
+            byte(0x99);
+            return;
+        case Op::idiv:
+            if (dst.kind == Operand::Kind::reg) {
+                // REX.W F7 /7
+                rex(true, 0, dst.reg);
+                byte(0xF7);
+                modrm_reg(7, dst.reg);
+                return;
+            }
+            break;
+        case Op::syscall:
+            byte(0x0F);
+            byte(0x05);
+            return;
+        case Op::ret:
+            byte(0xC3);
+            return;
+        }
+        std::stringstream msg;
+        msg << "Encoder: unsupported instruction form `" << op_name(instr.op) << " " << instr.dst << ", " << instr.src
+            << "`";
+        throw std::logic_error(msg.str());
+    }
+
+    inline void encode(const std::vector<Instr>& instrs)
+    {
+        for (const Instr& instr : instrs) {
+            encode(instr);
+        }
+    }
+
+    [[nodiscard]] inline const std::vector<uint8_t>& code() const
+    {
+        return m_code;
+    }
+
+    // Drop the bytes encoded so far (after they have been written out); instructions never refer to each other, so a
+    // program can be encoded in independent chunks.
+    inline void clear()
+    {
+        m_code.clear();
+    }
+
+private:
+    std::vector<uint8_t> m_code;
+
+    static inline uint8_t low3(Reg reg)
+    {
+        return static_cast<uint8_t>(reg) & 7;
+    }
+
+    static inline bool ext(Reg reg)
+    {
+        return static_cast<uint8_t>(reg) >= 8;
+    }
+
+    inline void byte(uint8_t b)
+    {
+        m_code.push_back(b);
+    }
+
+    inline void imm32(int32_t value)
+    {
+        for (int i = 0; i < 4; i++) {
+            byte(static_cast<uint8_t>(static_cast<uint32_t>(value) >> (i * 8)));
+        }
+    }
+
+    inline void imm64(int64_t value)
+    {
+        for (int i = 0; i < 8; i++) {
+            byte(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (i * 8)));
+        }
+    }
+
+    // REX prefix; omitted when it would be a no-op. `reg` is the ModRM.reg field, `rm` the ModRM.rm/base/opcode reg.
+    inline void rex(bool w, uint8_t reg, Reg rm)
+    {
+        uint8_t prefix = 0x40 | (w ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | (ext(rm) ? 0x01 : 0);
+        if (prefix != 0x40) {
+            byte(prefix);
+        }
+    }
+
+    inline void modrm_reg(uint8_t reg, Reg rm)
+    {
+        byte(0xC0 | ((reg & 7) << 3) | low3(rm));
+    }
+
+    // ModRM (+SIB, +disp) for a [base + disp] operand.
+    inline void mem(uint8_t reg, const Operand& operand)
+    {
+        const auto disp = static_cast<int32_t>(operand.value);
+        const bool needs_sib = low3(operand.reg) == 4; // rsp, r12
+        const bool needs_disp = disp != 0 || low3(operand.reg) == 5; // rbp, r13 have no disp-less form
+        const bool disp8 = disp >= INT8_MIN && disp <= INT8_MAX;
+        const uint8_t mod = !needs_disp ? 0b00 : disp8 ? 0b01 : 0b10;
+        byte((mod << 6) | ((reg & 7) << 3) | (needs_sib ? 4 : low3(operand.reg)));
+        if (needs_sib) {
+            byte(0x24); // scale=1, no index, base=rsp/r12
+        }
+        if (mod == 0b01) {
+            byte(static_cast<uint8_t>(static_cast<int8_t>(disp)));
+        }
+        else if (mod == 0b10) {
+            imm32(disp);
+        }
+    }
+
+    // op r/m64, r64 (register direct), or the 32-bit form without REX.W
+    inline void rr(uint8_t opcode, Reg rm, Reg reg, bool w = true)
+    {
+        rex(w, static_cast<uint8_t>(reg), rm);
+        byte(opcode);
+        modrm_reg(static_cast<uint8_t>(reg), rm);
+    }
+
+    // group-1 ALU op (add /0, sub /5, ...) r/m64, imm: 83 /ext ib when it fits in a byte, else 81 /ext id
+    inline void ri(uint8_t ext, Reg rm, int64_t value)
+    {
+        if (value < INT32_MIN || value > INT32_MAX) {
+            throw std::logic_error("Encoder: immediate does not fit in 32 bits");
+        }
+        rex(true, 0, rm);
+        if (value >= INT8_MIN && value <= INT8_MAX) {
+            byte(0x83);
+            modrm_reg(ext, rm);
+            byte(static_cast<uint8_t>(static_cast<int8_t>(value)));
+        }
+        else {
+            byte(0x81);
+            modrm_reg(ext, rm);
+            imm32(static_cast<int32_t>(value));
+        }
+    }
+
+    // op with a register and a memory operand
+    inline void rm(uint8_t opcode, Reg reg, const Operand& operand)
+    {
+        rex(true, static_cast<uint8_t>(reg), operand.reg);
+        byte(opcode);
+        mem(static_cast<uint8_t>(reg), operand);
+    }
+
+    // shift group (shl /4, shr /5, sar /7) r/m64 by a constant: D1 /ext for 1, C1 /ext ib otherwise
+    inline void shift(uint8_t ext, Reg rm, int64_t count)
+    {
+        rex(true, 0, rm);
+        byte(count == 1 ? 0xD1 : 0xC1);
+        modrm_reg(ext, rm);
+        if (count != 1) {
+            byte(static_cast<uint8_t>(count));
+        }
+    }
+
+    // lea r64, [base + index*scale + disp]: ModRM.rm = 100 selects a SIB byte; rbp/r13 as base need a displacement
+    inline void lea(Reg reg, const Operand& address)
+    {
+        if (low3(address.index) == 4 && !ext(address.index)) {
+            throw std::logic_error("Encoder: rsp can't be an index register");
+        }
+        const auto disp = static_cast<int32_t>(address.value);
+        const bool needs_disp = disp != 0 || low3(address.reg) == 5;
+        const bool disp8 = disp >= INT8_MIN && disp <= INT8_MAX;
+        const uint8_t mod = !needs_disp ? 0b00 : disp8 ? 0b01 : 0b10;
+        const uint8_t scale_bits = address.scale == 8 ? 3 : address.scale == 4 ? 2 : address.scale == 2 ? 1 : 0;
+        byte(0x48 | (ext(reg) ? 0x04 : 0) | (ext(address.index) ? 0x02 : 0) | (ext(address.reg) ? 0x01 : 0));
+        byte(0x8D);
+        byte((mod << 6) | (low3(reg) << 3) | 4);
+        byte((scale_bits << 6) | (low3(address.index) << 3) | low3(address.reg));
+        if (mod == 0b01) {
+            byte(static_cast<uint8_t>(static_cast<int8_t>(disp)));
+        }
+        else if (mod == 0b10) {
+            imm32(disp);
+        }
+    }
+};
@@ -0,0 +1,119 @@
+// ArenaAllocator: allocations are aligned, `release` rewinds to a mark and hands the same memory out again, `reset`
+// keeps the chunks for the next cycle, growth chains bigger chunks, and moving keeps pointers valid.
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "arena.hpp"
+#include "check.hpp"
+
+static bool aligned(const void* p, size_t align)
+{
+    return reinterpret_cast<uintptr_t>(p) % align == 0;
+}
+
+static void test_alignment()
+{
+    ArenaAllocator arena(256);
+    for (const size_t align : { 1, 2, 4, 8, 16, 32, 64 }) {
+        arena.allocate(1, 1);
+        CHECK(aligned(arena.allocate(3, align), align));
+    }
+    auto* values = arena.alloc_array<int64_t>(5);
+    CHECK(aligned(values, alignof(int64_t)));
+    bool zeroed = true;
+    for (size_t i = 0; i < 5; i++) {
+        zeroed = zeroed && values[i] == 0;
+    }
+    CHECK(zeroed);
+}
+
+static void test_mark_release()
+{
+    ArenaAllocator arena(1024);
+    auto* kept = arena.emplace<int64_t>(41);
+    const size_t used = arena.bytes_used();
+    const ArenaAllocator::Mark mark = arena.mark();
+
+    void* first = arena.allocate(100, 8);
+    arena.allocate(200, 8);
+    CHECK(arena.bytes_used() >= used + 300);
+
+    arena.release(mark);
+    CHECK(arena.bytes_used() == used);
+    CHECK(arena.allocate(100, 8) == first);
+    CHECK(*kept == 41);
+
+    // a release back across a chunk boundary reuses the later chunk instead of allocating another
+    arena.release(mark);
+    arena.allocate(4096, 8);
+    const size_t chunks = arena.chunk_count();
+    const size_t reserved = arena.bytes_reserved();
+    CHECK(chunks == 2);
+    arena.release(mark);
+    arena.allocate(4096, 8);
+    CHECK(arena.chunk_count() == chunks);
+    CHECK(arena.bytes_reserved() == reserved);
+    CHECK(*kept == 41);
+}
+
+static void test_reset_and_growth()
+{
+    ArenaAllocator arena(64);
+    size_t peak = 0;
+    for (size_t i = 0; i < 100; i++) {
+        arena.allocate(48, 16);
+        CHECK(arena.bytes_used() >= peak);
+        peak = arena.bytes_used();
+    }
+    CHECK(arena.chunk_count() > 1);
+    CHECK(arena.chunk_count() < 10); // chunks double, so 100 allocations don't need 100 chunks
+    CHECK(arena.high_water_mark() == peak);
+
+    const size_t chunks = arena.chunk_count();
+    const size_t reserved = arena.bytes_reserved();
+    arena.reset();
+    CHECK(arena.bytes_used() == 0);
+    CHECK(arena.chunk_count() == chunks);
+    CHECK(arena.bytes_reserved() == reserved);
+
+    arena.allocate(16, 16);
+    CHECK(arena.high_water_mark() == peak); // across resets
+    for (size_t i = 0; i < 100; i++) {
+        arena.allocate(48, 16);
+    }
+    CHECK(arena.bytes_reserved() == reserved); // the second cycle fits in the first one's chunks
+}
+
+static void test_move()
+{
+    ArenaAllocator arena(128);
+    auto* value = arena.emplace<int64_t>(7);
+    for (size_t i = 0; i < 20; i++) {
+        arena.allocate(64, 8);
+    }
+    const size_t used = arena.bytes_used();
+
+    ArenaAllocator moved(std::move(arena));
+    CHECK(*value == 7);
+    CHECK(moved.bytes_used() == used);
+
+    ArenaAllocator assigned;
+    assigned = std::move(moved);
+    CHECK(*value == 7);
+    CHECK(assigned.bytes_used() == used);
+    const ArenaAllocator::Mark mark = assigned.mark();
+    auto* next = assigned.emplace<int64_t>(8);
+    assigned.release(mark);
+    CHECK(assigned.emplace<int64_t>(9) == next);
+}
+
+int main()
+{
+    test_alignment();
+    test_mark_release();
+    test_reset_and_growth();
+    test_move();
+    return checks_done();
+}
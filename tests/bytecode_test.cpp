@@ -0,0 +1,161 @@
+// Bytecode: a program written with `write_bytecode` reads back identical and runs the same, and `verify()` /
+// `read_bytecode` reject every kind of broken input instead of handing it to the interpreter, which doesn't check.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "check.hpp"
+#include "io.hpp"
+#include "vm.hpp"
+
+static Bytecode compile(const std::string& source)
+{
+    CompileOptions options;
+    options.optimize = false; // keep the arithmetic for the VM to do
+    options.emit_object = false;
+    options.emit_bytecode = true;
+    const CompileResult result = CompileSession(options).compile(source);
+    CHECK(result.ok() && result.bytecode.has_value());
+    return result.bytecode.value_or(Bytecode {});
+}
+
+static std::string serialize(const Bytecode& bc)
+{
+    const std::filesystem::path path
+        = std::filesystem::temp_directory_path() / ("io_bytecode_test_" + std::to_string(getpid()) + ".iobc");
+    CHECK(write_bytecode(path.string(), bc));
+    std::ifstream file(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::filesystem::remove(path);
+    return bytes;
+}
+
+static bool same(const Bytecode& a, const Bytecode& b)
+{
+    return a.reg_count == b.reg_count && a.consts == b.consts && a.code == b.code;
+}
+
+static void test_round_trip()
+{
+    const Bytecode bc = compile("let a = 9223372036854775807;\nlet b = a - 7 * 3;\nlet c = b / 0 - 4;\nexit(b / 3);");
+    CHECK(bc.verify());
+    const std::string bytes = serialize(bc);
+    CHECK(bytes.size() == sizeof(BytecodeHeader) + bc.consts.size() * 8 + bc.code.size() * 4);
+
+    const std::optional<Bytecode> read = read_bytecode(bytes);
+    CHECK(read.has_value() && same(*read, bc));
+    if (read.has_value()) {
+        const VmResult expected = Vm(bc).run();
+        const VmResult got = Vm(*read).run();
+        CHECK(got.trapped == expected.trapped && got.value == expected.value);
+        CHECK(got.trapped); // `b / 0` is evaluated even though `c` is never used
+    }
+
+    const Bytecode exits = compile("let x = 6;\nexit(x * 7);");
+    const std::optional<Bytecode> read_exits = read_bytecode(serialize(exits));
+    CHECK(read_exits.has_value() && same(*read_exits, exits));
+    if (read_exits.has_value()) {
+        const VmResult result = Vm(*read_exits).run();
+        CHECK(!result.trapped && result.value == 42);
+    }
+}
+
+static void test_read_rejects()
+{
+    const std::string bytes = serialize(compile("let a = 5;\nlet b = a * 3 + 2;\nexit(b - a);"));
+    CHECK(read_bytecode(bytes).has_value());
+
+    bool truncated_rejected = true;
+    for (size_t size = 0; size < bytes.size(); size++) {
+        truncated_rejected = truncated_rejected && !read_bytecode(std::string_view(bytes).substr(0, size));
+    }
+    CHECK(truncated_rejected);
+    CHECK(!read_bytecode(bytes + '\0'));
+
+    std::string magic = bytes;
+    magic[0] = 'X';
+    CHECK(!read_bytecode(magic));
+
+    std::string version = bytes;
+    version[offsetof(BytecodeHeader, version)]++;
+    CHECK(!read_bytecode(version));
+
+    // a huge word count must not be taken at its word
+    std::string words = bytes;
+    std::fill_n(words.begin() + offsetof(BytecodeHeader, code_words), sizeof(uint64_t), '\xff');
+    CHECK(!read_bytecode(words));
+
+    // Any single corrupted byte is either rejected or still a program the VM can run safely.
+    bool corrupt_safe = true;
+    for (size_t i = 0; i < bytes.size(); i++) {
+        for (const char value : { '\x00', '\x01', '\x07', '\x7f', '\xff' }) {
+            std::string corrupt = bytes;
+            corrupt[i] = value;
+            const std::optional<Bytecode> bc = read_bytecode(corrupt);
+            if (bc.has_value()) {
+                corrupt_safe = corrupt_safe && bc->verify();
+                Vm(*bc).run();
+            }
+        }
+    }
+    CHECK(corrupt_safe);
+}
+
+static uint32_t word(BcOp op)
+{
+    return static_cast<uint32_t>(op);
+}
+
+static void test_verify_rejects()
+{
+    // r0 = 7; r1 = r0 * r0; exit r1
+    Bytecode good;
+    good.reg_count = 2;
+    good.consts = { 7 };
+    good.code = { word(BcOp::imm), 0, 0, word(BcOp::mul), 1, 0, 0, word(BcOp::exit), 1 };
+    CHECK(good.verify());
+    CHECK(Vm(good).run().value == 49);
+
+    Bytecode no_exit = good;
+    no_exit.code.resize(7);
+    CHECK(!no_exit.verify());
+
+    Bytecode incomplete = good;
+    incomplete.code.pop_back();
+    CHECK(!incomplete.verify());
+
+    Bytecode unknown_op = good;
+    unknown_op.code[3] = word(BcOp::count);
+    CHECK(!unknown_op.verify());
+
+    Bytecode bad_reg = good;
+    bad_reg.code[6] = 2;
+    CHECK(!bad_reg.verify());
+
+    Bytecode bad_const = good;
+    bad_const.code[2] = 1;
+    CHECK(!bad_const.verify());
+
+    Bytecode too_many_regs = good;
+    too_many_regs.reg_count = static_cast<uint32_t>(good.code.size()) + 1;
+    CHECK(!too_many_regs.verify());
+
+    CHECK(!Bytecode {}.verify());
+}
+
+int main()
+{
+    test_round_trip();
+    test_read_rejects();
+    test_verify_rejects();
+    return checks_done();
+}
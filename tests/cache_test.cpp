@@ -0,0 +1,183 @@
+// CompileCache: a stored entry is fetched by hardlink (or by copy across file systems), a miss - including an entry
+// that has only some of the wanted artifacts - leaves existing outputs alone, and pruning evicts least recently used
+// entries first.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cache.hpp"
+#include "check.hpp"
+
+static std::filesystem::path make_temp_dir(const std::filesystem::path& parent)
+{
+    std::string dir_template = (parent / "io_cache_test_XXXXXX").string();
+    return mkdtemp(dir_template.data()) == nullptr ? std::filesystem::path() : std::filesystem::path(dir_template);
+}
+
+static void write_file(const std::filesystem::path& path, const std::string& text)
+{
+    std::ofstream(path, std::ios::binary) << text;
+}
+
+static std::string read_file(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+}
+
+static nlink_t link_count(const std::filesystem::path& path)
+{
+    struct stat st {};
+    return stat(path.c_str(), &st) == 0 ? st.st_nlink : 0;
+}
+
+// nothing but `names` in `dir`: no staged temp files left behind
+static bool only_files(const std::filesystem::path& dir, size_t count)
+{
+    return static_cast<size_t>(std::distance(std::filesystem::directory_iterator(dir), {})) == count;
+}
+
+// the cache's mtimes have file system timestamp granularity
+static void tick()
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+}
+
+static void test_key()
+{
+    const std::string key = CompileCache::key("io 1", "regs", "exit(1);");
+    CHECK(key.size() == 64);
+    CHECK(key == CompileCache::key("io 1", "regs", "exit(1);"));
+    CHECK(key != CompileCache::key("io 2", "regs", "exit(1);"));
+    CHECK(key != CompileCache::key("io 1", "stack", "exit(1);"));
+    CHECK(key != CompileCache::key("io 1", "regs", "exit(2);"));
+    CHECK(CompileCache::key("ab", "c", "") != CompileCache::key("a", "bc", ""));
+}
+
+static void test_hit_and_miss(const std::filesystem::path& dir)
+{
+    CompileCache cache(dir / "cache");
+    CHECK(cache.ok());
+    const std::filesystem::path work = dir / "work";
+    std::filesystem::create_directories(work);
+    const std::string exe = (work / "out").string();
+    const std::string asm_path = exe + ".asm";
+    const std::string key = CompileCache::key("io", "", "exit(1);");
+
+    write_file(exe, "old executable");
+    write_file(asm_path, "old listing");
+    CHECK(!cache.fetch(key, { { CacheArtifact::executable, exe } }));
+    CHECK(cache.misses() == 1);
+    CHECK(read_file(exe) == "old executable");
+
+    write_file(work / "built", "new executable");
+    CHECK(cache.store(key, CacheArtifact::executable, (work / "built").string()));
+
+    // the entry has no listing: a miss, and neither output may be touched
+    CHECK(!cache.fetch(key, { { CacheArtifact::executable, exe }, { CacheArtifact::assembly, asm_path } }));
+    CHECK(cache.misses() == 2);
+    CHECK(read_file(exe) == "old executable");
+    CHECK(read_file(asm_path) == "old listing");
+
+    CHECK(cache.fetch(key, { { CacheArtifact::executable, exe } }));
+    CHECK(cache.hits() == 1);
+    CHECK(read_file(exe) == "new executable");
+    CHECK(read_file(asm_path) == "old listing");
+    CHECK(link_count(exe) == 2); // the entry and `out`
+    CHECK(only_files(work, 3));
+
+    CHECK(cache.flush_stats());
+    const CacheStats stats = cache.stats();
+    CHECK(stats.hits == 1 && stats.misses == 2);
+    CHECK(stats.entries == 1 && stats.bytes == std::string("new executable").size());
+    CHECK(cache.hits() == 0 && cache.misses() == 0);
+}
+
+static void test_copy_across_file_systems(const std::filesystem::path& dir)
+{
+    struct stat here {};
+    struct stat shm {};
+    if (stat(dir.c_str(), &here) != 0 || stat("/dev/shm", &shm) != 0 || here.st_dev == shm.st_dev) {
+        std::cerr << "no second file system, copy fallback not tested" << std::endl;
+        return;
+    }
+    const std::filesystem::path work = make_temp_dir("/dev/shm");
+    CHECK(!work.empty());
+    if (work.empty()) {
+        return;
+    }
+    CompileCache cache(dir / "cache_copy");
+    const std::string key = CompileCache::key("io", "", "exit(2);");
+    write_file(dir / "built_copy", "listing");
+    CHECK(cache.store(key, CacheArtifact::assembly, (dir / "built_copy").string()));
+
+    const std::string listing = (work / "out.asm").string();
+    write_file(listing, "old listing");
+    CHECK(cache.fetch(key, { { CacheArtifact::assembly, listing } }));
+    CHECK(read_file(listing) == "listing");
+    CHECK(link_count(listing) == 1);
+    CHECK(access(listing.c_str(), W_OK) == 0); // unlike the read-only entry
+    CHECK(only_files(work, 1));
+
+    std::error_code ignored;
+    std::filesystem::remove_all(work, ignored);
+}
+
+static void test_prune(const std::filesystem::path& dir)
+{
+    CompileCache cache(dir / "cache_prune");
+    const std::vector<std::pair<std::string, std::string>> entries = {
+        { CompileCache::key("io", "", "a"), std::string(100, 'a') },
+        { CompileCache::key("io", "", "b"), std::string(200, 'b') },
+        { CompileCache::key("io", "", "c"), std::string(300, 'c') },
+    };
+    for (const auto& [key, contents] : entries) {
+        write_file(dir / "built_prune", contents);
+        CHECK(cache.store(key, CacheArtifact::executable, (dir / "built_prune").string()));
+        CHECK(cache.store(key, CacheArtifact::ir, (dir / "built_prune").string()));
+        tick();
+    }
+    // using `a` makes `b` the least recently used
+    const std::string out = (dir / "out_prune").string();
+    CHECK(cache.fetch(entries[0].first, { { CacheArtifact::executable, out } }));
+    CHECK(cache.stats().entries == 3);
+
+    const CachePruneResult pruned = cache.prune(1000);
+    CHECK(pruned.removed_entries == 1);
+    CHECK(pruned.removed_bytes == 400); // both artifacts of `b`
+    CHECK(pruned.remaining_bytes == 800);
+    CHECK(!cache.fetch(entries[1].first, { { CacheArtifact::executable, out } }));
+    CHECK(cache.fetch(entries[0].first, { { CacheArtifact::ir, out } }));
+    CHECK(cache.fetch(entries[2].first, { { CacheArtifact::executable, out } }));
+
+    CHECK(cache.prune(2000).removed_entries == 0);
+    CHECK(cache.prune(0).removed_entries == 2);
+    CHECK(cache.stats().entries == 0);
+}
+
+int main()
+{
+    const std::filesystem::path dir = make_temp_dir(std::filesystem::temp_directory_path());
+    if (dir.empty()) {
+        std::cerr << "Failed to create a temporary directory" << std::endl;
+        return EXIT_FAILURE;
+    }
+    test_key();
+    test_hit_and_miss(dir);
+    test_copy_across_file_systems(dir);
+    test_prune(dir);
+
+    std::error_code ignored;
+    std::filesystem::remove_all(dir, ignored);
+    return checks_done();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// Assertions for the unit tests: `CHECK(condition)` reports a failure with its location and keeps going,
+// `checks_done()` prints the tally and is `main`'s return value.
+
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+
+inline size_t g_checks = 0;
+inline size_t g_failures = 0;
+
+inline void check(bool ok, const char* condition, const char* file, int line)
+{
+    g_checks++;
+    if (!ok) {
+        g_failures++;
+        std::cerr << file << ":" << line << ": FAIL " << condition << std::endl;
+    }
+}
+
+#define CHECK(condition) check(static_cast<bool>(condition), #condition, __FILE__, __LINE__)
+
+inline int checks_done()
+{
+    std::cerr << g_checks << " check(s), " << g_failures << " failed" << std::endl;
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,294 @@
+// End-to-end check of every way to run a program: each program below is compiled optimized and with `--no-opt`, with
+// register and stack codegen, with and without the peephole pass, then run as an executable, as JIT code, in the VM
+// and as a `--watch` build, and every exit status must be the expected one. Programs that don't compile must fail
+// with the expected diagnostic in a one-shot and a watch build. Registered with CTest; exits non-zero on any mismatch.
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "incremental.hpp"
+#include "io.hpp"
+#include "jit.hpp"
+#include "vm.hpp"
+
+struct Program {
+    const char* name;
+    std::string source;
+    int status; // exit status, as the shell reports it: 128 + SIGFPE for a trap
+};
+
+struct BadProgram {
+    const char* name;
+    std::string source;
+    std::string diagnostic; // the first one, for input `input`
+};
+
+constexpr int TRAP = 128 + SIGFPE;
+
+static std::vector<Program> programs()
+{
+    return {
+        { "exit", "exit(42);", 42 },
+        { "lets", "let a = 7;\nlet b = a * 3 + 1;\nexit(b);", 22 },
+        { "precedence", "let a = 100;\nlet b = a / 7 - a * 2 / 3 + 5;\nexit(b);", 209 },
+        { "negative_division", "let a = 0 - 13;\nlet b = a / 4 + a / 2 + a / 1;\nexit(b + 40);", 18 },
+        { "strength_reduction",
+          "let x = 9;\nlet y = x * 2 + x * 4 + x * 8 + x * 3 + x * 5 + x * 9 + x * 0 + x * 1 - x * 64;\n"
+          "exit(y + x * 40 - 1 + 0 - x);",
+          62 },
+        { "wraparound", "let big = 9223372036854775807;\nexit(big + 1 + 5);", 5 },
+        { "register_pressure",
+          "let a = 3;\nlet b = 5;\nlet c = 7;\n"
+          "exit(a + b / c * a - b * c / a + a * b * c / b - c / a / b + a - b);",
+          11 },
+        { "unreachable", "exit(3);\nlet x = 1 / 0;", 3 },
+        { "implicit_exit", "let b = 2;", 0 },
+        { "implicit_exit_after_lets", "let a = 1;\nlet b = a * 5;", 0 },
+        { "division_by_zero", "let z = 0;\nexit(7 / z);", TRAP },
+        { "division_overflow", "let m = 0 - 9223372036854775807 - 1;\nlet n = 0 - 1;\nexit(m / n);", TRAP },
+        { "unused_division_by_zero", "let x = 5 / 0;\nexit(3);", TRAP },
+        { "unused_division_overflow",
+          "let m = 0 - 9223372036854775807 - 1;\nlet n = 0 - 1;\nlet x = m / n;\nexit(3);",
+          TRAP },
+        { "unused_division", "let x = 5 / 2;\nlet y = x / 7;\nexit(3);", 3 },
+    };
+}
+
+static std::vector<BadProgram> bad_programs()
+{
+    return {
+        { "undeclared", "exit(x);", "input:1:6: error: Undeclared identifier: x" },
+        // `b * c` is evaluated first, but `a` comes first in the source
+        { "undeclared_leftmost",
+          "let q = 1;\nlet y = a + b * c;\nexit(y);",
+          "input:2:9: error: Undeclared identifier: a" },
+        { "self_reference", "let x = x;", "input:1:9: error: Undeclared identifier: x" },
+        { "redeclared", "let a = 1;\nlet a = 2;\nexit(a);", "input:2:5: error: Identifier already used: a" },
+    };
+}
+
+// `let v1 = ...; ...` long enough (over `2 * Tokenizer::PARALLEL_MIN_BYTES`) for parallel lexing and code generation,
+// with its exit status computed here.
+static Program large_program()
+{
+    constexpr int LETS = 50000;
+    std::ostringstream source;
+    source << "let v0 = 1;\n";
+    int64_t v = 1;
+    for (int i = 1; i <= LETS; i++) {
+        source << "let v" << i << " = v" << i - 1 << " * 3 + " << i << " / 7 - v" << i - 1 << " / 5;\n";
+        v = static_cast<int64_t>(static_cast<uint64_t>(v) * 3 + static_cast<uint64_t>(i / 7)
+                                 - static_cast<uint64_t>(v / 5));
+    }
+    source << "exit(v" << LETS << ");\n";
+    return { "large", source.str(), static_cast<int>(static_cast<uint64_t>(v) & 0xFF) };
+}
+
+// Exit status of a finished child, 128 + signal if it was killed.
+static int wait_status(pid_t pid)
+{
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid) {
+        return -1;
+    }
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+static int run_executable(const std::string& path)
+{
+    const pid_t pid = fork();
+    if (pid == 0) {
+        execl(path.c_str(), path.c_str(), nullptr);
+        _exit(127);
+    }
+    return wait_status(pid);
+}
+
+// In a child process, so a trapping program doesn't take the test down.
+static int run_jit_code(const std::vector<uint8_t>& code)
+{
+    const pid_t pid = fork();
+    if (pid == 0) {
+        const std::optional<int> status = run_jit(code);
+        _exit(status.value_or(127));
+    }
+    return wait_status(pid);
+}
+
+static int run_bytecode(const Bytecode& bc)
+{
+    if (!bc.verify()) {
+        return -1;
+    }
+    const VmResult result = Vm(bc).run();
+    return result.trapped ? TRAP : static_cast<int>(static_cast<uint64_t>(result.value) & 0xFF);
+}
+
+static std::string options_name(const CompileOptions& options)
+{
+    std::string name = options.optimize ? "opt" : "no-opt";
+    name += options.codegen == CodegenMode::regs ? " regs" : " stack";
+    name += options.peephole ? "" : " no-peephole";
+    name += options.threads == 1 ? "" : " threads=" + std::to_string(options.threads);
+    return name;
+}
+
+class Checker {
+public:
+    inline explicit Checker(std::filesystem::path dir)
+        : m_dir(std::move(dir))
+    {
+    }
+
+    void expect(const std::string& what, int status, int expected)
+    {
+        m_checks++;
+        if (status != expected) {
+            m_failures++;
+            std::cerr << "FAIL " << what << ": exit status " << status << ", expected " << expected << std::endl;
+        }
+    }
+
+    void expect_diagnostic(const std::string& what, const CompileResult& result, const std::string& expected)
+    {
+        m_checks++;
+        if (result.ok()) {
+            m_failures++;
+            std::cerr << "FAIL " << what << ": compiled without error" << std::endl;
+            return;
+        }
+        const std::string got = result.diagnostics.front().format("input");
+        if (got != expected) {
+            m_failures++;
+            std::cerr << "FAIL " << what << ": `" << got << "`, expected `" << expected << "`" << std::endl;
+        }
+    }
+
+    // Compile and run `program` every way `options` allows.
+    void run(const Program& program, CompileOptions options)
+    {
+        const std::string what = std::string(program.name) + " [" + options_name(options) + "]";
+        const std::string path = (m_dir / program.name).string();
+
+        const CompileResult exe = CompileSession(options).compile_to_file(program.source, path);
+        expect(what + " executable", exe.ok() ? run_executable(path) : -1, program.status);
+
+        options.target = CodegenTarget::jit;
+        const CompileResult jit = CompileSession(options).compile(program.source);
+        expect(what + " jit", jit.ok() ? run_jit_code(jit.object) : -1, program.status);
+
+        options.target = CodegenTarget::executable;
+        options.emit_object = false;
+        options.emit_bytecode = true;
+        const CompileResult vm = CompileSession(options).compile(program.source);
+        expect(what + " vm", vm.ok() && vm.bytecode ? run_bytecode(*vm.bytecode) : -1, program.status);
+    }
+
+    // Compiled on `options.threads` threads, `program` must come out byte for byte as compiled on one.
+    void expect_same_output(const Program& program, CompileOptions options)
+    {
+        const std::string what = std::string(program.name) + " [" + options_name(options) + "] matches threads=1";
+        options.emit_assembly = true;
+        const CompileResult parallel = CompileSession(options).compile(program.source);
+        options.threads = 1;
+        const CompileResult serial = CompileSession(options).compile(program.source);
+        m_checks++;
+        if (!parallel.ok() || !serial.ok() || parallel.object != serial.object
+            || parallel.assembly != serial.assembly) {
+            m_failures++;
+            std::cerr << "FAIL " << what << std::endl;
+        }
+    }
+
+    // A watch session that sees `corpus` as successive edits of one file.
+    void run_watch(const std::vector<Program>& corpus, const CompileOptions& options)
+    {
+        IncrementalCompiler compiler(options);
+        const std::string path = (m_dir / "watch").string();
+        for (const Program& program : corpus) {
+            const CompileResult result = compiler.update(program.source, path);
+            const std::string what = std::string(program.name) + " [" + options_name(options) + "] watch";
+            expect(what, result.ok() ? run_executable(path) : -1, program.status);
+        }
+    }
+
+    void check_errors(const std::vector<BadProgram>& corpus, const CompileOptions& options)
+    {
+        const std::string path = (m_dir / "bad").string();
+        for (const BadProgram& program : corpus) {
+            const std::string what = std::string(program.name) + " [" + options_name(options) + "]";
+            expect_diagnostic(what, CompileSession(options).compile(program.source), program.diagnostic);
+            if (options.optimize) {
+                // watch builds don't run the optimizer
+                const CompileResult watch = IncrementalCompiler(options).update(program.source, path);
+                expect_diagnostic(what + " watch", watch, program.diagnostic);
+            }
+        }
+    }
+
+    [[nodiscard]] int report() const
+    {
+        std::cerr << m_checks << " check(s), " << m_failures << " failed" << std::endl;
+        return m_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+private:
+    std::filesystem::path m_dir;
+    size_t m_checks = 0;
+    size_t m_failures = 0;
+};
+
+int main()
+{
+    std::string dir_template = (std::filesystem::temp_directory_path() / "io_e2e_XXXXXX").string();
+    if (mkdtemp(dir_template.data()) == nullptr) {
+        std::cerr << "Failed to create a temporary directory" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path dir = dir_template;
+    Checker checker(dir);
+
+    const std::vector<Program> corpus = programs();
+    for (const bool optimize : { true, false }) {
+        for (const CodegenMode codegen : { CodegenMode::regs, CodegenMode::stack }) {
+            for (const bool peephole : { true, false }) {
+                CompileOptions options;
+                options.codegen = codegen;
+                options.optimize = optimize;
+                options.peephole = peephole;
+                for (const Program& program : corpus) {
+                    checker.run(program, options);
+                }
+                if (optimize) {
+                    // watch builds don't run the optimizer
+                    checker.run_watch(corpus, options);
+                }
+                checker.check_errors(bad_programs(), options);
+            }
+        }
+    }
+    const Program large = large_program();
+    checker.expect("large program splits for the lexer", large.source.size() >= 2 * Tokenizer::PARALLEL_MIN_BYTES, 1);
+    for (const bool optimize : { true, false }) {
+        CompileOptions options;
+        options.optimize = optimize;
+        options.threads = 4;
+        checker.run(large, options);
+        checker.expect_same_output(large, options);
+    }
+    checker.run_watch({ large }, {});
+
+    std::error_code ignored;
+    std::filesystem::remove_all(dir, ignored);
+    return checker.report();
+}
@@ -0,0 +1,127 @@
+// Tokenizer: `tokenize_parallel` must produce exactly what `tokenize` does - the same kinds, records, integer values
+// and symbol ids - on sources big enough to be split, and report the same first error.
+
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "thread_pool.hpp"
+#include "tokenization.hpp"
+
+// Random token soup (it doesn't have to parse) with every token kind, names long and short that share prefixes,
+// extreme integers and mixed whitespace, `;`-separated like real code so there are places to split.
+static std::string soup(size_t bytes, uint32_t seed)
+{
+    static const std::vector<std::string> words = {
+        "let", "exit", "x", "y", "letter", "exitcode", "counter0", "counter00", "counter000",
+        "aRatherLongIdentifierName", "aRatherLongIdentifierNam", "v12", "let2", "0", "7",
+        "9223372036854775807", "00042", "+", "-", "*", "/", "(", ")", "=",
+    };
+    static const std::vector<std::string> spaces = { " ", "  ", "\t", "\n", "\r\n", " \n\t " };
+    std::mt19937 rng(seed);
+    std::string source;
+    source.reserve(bytes + 64);
+    while (source.size() < bytes) {
+        source += words[rng() % words.size()];
+        source += spaces[rng() % spaces.size()];
+        if (rng() % 6 == 0) {
+            source += ";";
+            source += spaces[rng() % spaces.size()];
+        }
+    }
+    return source;
+}
+
+static bool same_tokens(const TokenStream& a, const TokenStream& b)
+{
+    if (a.size() != b.size() || a.int_lits.size() != b.int_lits.size() || a.symbols.size() != b.symbols.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a.kinds[i] != b.kinds[i] || a.records[i].offset != b.records[i].offset
+            || a.records[i].data != b.records[i].data) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < a.int_lits.size(); i++) {
+        if (a.int_lits[i] != b.int_lits[i]) {
+            return false;
+        }
+    }
+    for (SymbolId id = 0; id < a.symbols.size(); id++) {
+        if (a.symbols.name(id) != b.symbols.name(id)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct LexError {
+    std::string message;
+    size_t offset;
+
+    bool operator==(const LexError&) const = default;
+};
+
+static std::optional<LexError> lex_error(const std::string& source, ThreadPool* pool)
+{
+    try {
+        pool != nullptr ? Tokenizer(source).tokenize_parallel(*pool) : Tokenizer(source).tokenize();
+    }
+    catch (const CompileError& error) {
+        return LexError { error.what(), error.offset() };
+    }
+    return {};
+}
+
+static void test_identical()
+{
+    for (const size_t workers : { 1, 3 }) {
+        ThreadPool pool(workers);
+        for (const size_t bytes : { 1u << 10, (2u << 20) + 12345, 4u << 20 }) {
+            const std::string source = soup(bytes, static_cast<uint32_t>(bytes + workers));
+            const TokenStream serial = Tokenizer(source).tokenize();
+            const TokenStream parallel = Tokenizer(source).tokenize_parallel(pool);
+            CHECK(serial.size() > bytes / 16);
+            CHECK(same_tokens(serial, parallel));
+        }
+    }
+}
+
+// One `;` at the very end: nowhere to split, lexed in one piece.
+static void test_unsplittable()
+{
+    ThreadPool pool(3);
+    std::string source(3u << 20, ' ');
+    source += "exit(0);";
+    CHECK(same_tokens(Tokenizer(source).tokenize(), Tokenizer(source).tokenize_parallel(pool)));
+}
+
+// Errors in several chunks: the first one in the source is reported, at the same offset.
+static void test_first_error()
+{
+    ThreadPool pool(3);
+    std::string source = soup(3u << 20, 1);
+    source[source.size() / 2] = '$';
+    source[source.size() - 10] = '@';
+    const std::optional<LexError> serial = lex_error(source, nullptr);
+    CHECK(serial.has_value() && serial->offset == source.size() / 2);
+    CHECK(lex_error(source, &pool) == serial);
+
+    std::string out_of_range = soup(3u << 20, 2);
+    out_of_range.replace(out_of_range.size() / 3, 22, " 18446744073709551616 ");
+    const std::optional<LexError> range_error = lex_error(out_of_range, nullptr);
+    CHECK(range_error.has_value());
+    CHECK(lex_error(out_of_range, &pool) == range_error);
+}
+
+int main()
+{
+    test_identical();
+    test_unsplittable();
+    test_first_error();
+    return checks_done();
+}
@@ -0,0 +1,88 @@
+// PhaseTimer: a phase that hands work to a thread pool through `PhaseTimer::counted` reports the CPU time and heap
+// allocations of that work whichever thread ran it, without counting the calling thread's share twice. Linked with
+// alloc_hook.cpp so allocations are counted.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "check.hpp"
+#include "metrics.hpp"
+#include "thread_pool.hpp"
+
+constexpr size_t TASKS = 8;
+constexpr double TASK_CPU_MS = 5;
+constexpr size_t TASK_BYTES = 1 << 20;
+// `submit` and `parallel_for` allocate a little themselves
+constexpr uint64_t POOL_OVERHEAD_BYTES = 64 * 1024;
+
+static void task(size_t)
+{
+    const auto block = std::make_unique<char[]>(TASK_BYTES);
+    block[0] = 1;
+    const double start = PhaseTimer::thread_cpu_ms();
+    while (PhaseTimer::thread_cpu_ms() - start < TASK_CPU_MS) { }
+}
+
+static PhaseTime run_phase(size_t workers)
+{
+    CompileMetrics metrics;
+    ThreadPool pool(workers);
+    {
+        const PhaseTimer timer(&metrics, "parallel");
+        pool.parallel_for(TASKS, PhaseTimer::counted(task));
+    }
+    CHECK(metrics.phases.size() == 1);
+    return metrics.phases.empty() ? PhaseTime {} : metrics.phases.front();
+}
+
+static void test_parallel_phase()
+{
+    CHECK(g_allocation_hook);
+    for (const size_t workers : { 0, 1, 3 }) {
+        const PhaseTime phase = run_phase(workers);
+        CHECK(phase.cpu_ms >= TASKS * TASK_CPU_MS);
+        CHECK(phase.allocated_bytes >= TASKS * TASK_BYTES);
+        CHECK(phase.allocated_bytes < TASKS * TASK_BYTES + POOL_OVERHEAD_BYTES);
+        CHECK(phase.allocations >= TASKS);
+    }
+}
+
+// Tasks count toward the innermost phase running when they were wrapped, not one that already ended.
+static void test_nested_phases()
+{
+    CompileMetrics metrics;
+    ThreadPool pool(2);
+    {
+        const PhaseTimer outer(&metrics, "outer");
+        {
+            const PhaseTimer inner(&metrics, "inner");
+        }
+        pool.parallel_for(TASKS, PhaseTimer::counted(task));
+    }
+    CHECK(metrics.phases.size() == 2);
+    if (metrics.phases.size() == 2) {
+        CHECK(metrics.phases[0].name == "inner" && metrics.phases[1].name == "outer");
+        CHECK(metrics.phases[0].allocated_bytes < TASK_BYTES);
+        CHECK(metrics.phases[1].allocated_bytes >= TASKS * TASK_BYTES);
+    }
+}
+
+// Without metrics the wrapper just runs the task.
+static void test_no_metrics()
+{
+    size_t ran = 0;
+    {
+        const PhaseTimer timer(nullptr, "off");
+        ThreadPool(0).parallel_for(TASKS, PhaseTimer::counted([&](size_t) { ran++; }));
+    }
+    CHECK(ran == TASKS);
+}
+
+int main()
+{
+    test_parallel_phase();
+    test_nested_phases();
+    test_no_metrics();
+    return checks_done();
+}
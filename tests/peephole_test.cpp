@@ -0,0 +1,211 @@
+// PeepholeOptimizer: each rule rewrites the pattern it is for and is counted for it, doesn't fire when the register
+// it drops is still read, and is skipped when disabled or when it needs a longer window than allowed.
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "peephole.hpp"
+
+static const Instr EXIT_RAX = { .op = Op::mov, .dst = Operand::r(Reg::rax), .src = Operand::imm(60) };
+static const Instr SYSCALL = { .op = Op::syscall };
+
+// `a; b; c` without the indentation
+static std::string listing(const std::vector<Instr>& instrs)
+{
+    std::ostringstream out;
+    for (const Instr& instr : instrs) {
+        std::ostringstream line;
+        line << instr;
+        out << (out.tellp() == 0 ? "" : "; ") << line.str().substr(4);
+    }
+    return out.str();
+}
+
+static PeepholeOptions only(PeepholeRule rule)
+{
+    PeepholeOptions options;
+    options.enabled.fill(false);
+    options.enabled[static_cast<size_t>(rule)] = true;
+    return options;
+}
+
+// Run `instrs`, followed by the exit syscall that keeps rax and rdi live, and compare the result.
+static bool rewrites(PeepholeOptimizer& peephole, std::vector<Instr> instrs, const std::string& expected)
+{
+    instrs.push_back(EXIT_RAX);
+    instrs.push_back(SYSCALL);
+    peephole.run(instrs);
+    const std::string got = listing(instrs);
+    const std::string want = expected + (expected.empty() ? "" : "; ") + "mov rax, 60; syscall";
+    if (got != want) {
+        std::cerr << "got `" << got << "`, expected `" << want << "`" << std::endl;
+    }
+    return got == want;
+}
+
+static void test_push_pop()
+{
+    PeepholeOptimizer peephole(only(PeepholeRule::push_pop));
+    CHECK(rewrites(peephole,
+                   { { .op = Op::push, .dst = Operand::r(Reg::rcx) }, { .op = Op::pop, .dst = Operand::r(Reg::rdi) } },
+                   "mov rdi, rcx"));
+    CHECK(peephole.applied(PeepholeRule::push_pop) == 1);
+    CHECK(peephole.removed(PeepholeRule::push_pop) == 1);
+
+    CHECK(rewrites(peephole,
+                   { { .op = Op::push, .dst = Operand::r(Reg::rdi) }, { .op = Op::pop, .dst = Operand::r(Reg::rdi) } },
+                   ""));
+    // counts add up over runs
+    CHECK(peephole.applied(PeepholeRule::push_pop) == 2);
+    CHECK(peephole.removed(PeepholeRule::push_pop) == 3);
+
+    // an immediate push is left alone
+    CHECK(rewrites(peephole,
+                   { { .op = Op::push, .dst = Operand::imm(3) }, { .op = Op::pop, .dst = Operand::r(Reg::rdi) } },
+                   "push 3; pop rdi"));
+    CHECK(peephole.applied(PeepholeRule::push_pop) == 2);
+}
+
+static void test_push_pop_around()
+{
+    const std::vector<Instr> around = {
+        { .op = Op::push, .dst = Operand::r(Reg::rcx) },
+        { .op = Op::mov, .dst = Operand::r(Reg::rsi), .src = Operand::imm(5) },
+        { .op = Op::pop, .dst = Operand::r(Reg::rdi) },
+        { .op = Op::add, .dst = Operand::r(Reg::rdi), .src = Operand::r(Reg::rsi) },
+    };
+    PeepholeOptimizer peephole(only(PeepholeRule::push_pop_around));
+    CHECK(rewrites(peephole, around, "mov rsi, 5; mov rdi, rcx; add rdi, rsi"));
+    CHECK(peephole.applied(PeepholeRule::push_pop_around) == 1);
+    CHECK(peephole.removed(PeepholeRule::push_pop_around) == 1);
+
+    // it looks at 3 instructions
+    PeepholeOptions narrow = only(PeepholeRule::push_pop_around);
+    narrow.window = 2;
+    PeepholeOptimizer narrow_peephole(narrow);
+    CHECK(rewrites(narrow_peephole, around, "push rcx; mov rsi, 5; pop rdi; add rdi, rsi"));
+    CHECK(narrow_peephole.applied(PeepholeRule::push_pop_around) == 0);
+
+    // the instruction in between overwrites the pushed register
+    PeepholeOptimizer blocked(only(PeepholeRule::push_pop_around));
+    CHECK(rewrites(blocked,
+                   {
+                       { .op = Op::push, .dst = Operand::r(Reg::rdi) },
+                       { .op = Op::mov, .dst = Operand::r(Reg::rdi), .src = Operand::imm(5) },
+                       { .op = Op::pop, .dst = Operand::r(Reg::rsi) },
+                       { .op = Op::add, .dst = Operand::r(Reg::rdi), .src = Operand::r(Reg::rsi) },
+                   },
+                   "push rdi; mov rdi, 5; pop rsi; add rdi, rsi"));
+    CHECK(blocked.applied(PeepholeRule::push_pop_around) == 0);
+}
+
+static void test_copy_prop()
+{
+    const std::vector<Instr> copy = {
+        { .op = Op::mov, .dst = Operand::r(Reg::rcx), .src = Operand::mem(Reg::rbp, -8) },
+        { .op = Op::mov, .dst = Operand::r(Reg::rdi), .src = Operand::r(Reg::rcx) },
+    };
+    PeepholeOptimizer peephole(only(PeepholeRule::copy_prop));
+    CHECK(rewrites(peephole, copy, "mov rdi, QWORD [rbp - 8]"));
+    CHECK(peephole.applied(PeepholeRule::copy_prop) == 1);
+    CHECK(peephole.removed(PeepholeRule::copy_prop) == 1);
+
+    // rcx is read again afterwards
+    std::vector<Instr> live = copy;
+    live.push_back({ .op = Op::add, .dst = Operand::r(Reg::rdi), .src = Operand::r(Reg::rcx) });
+    CHECK(rewrites(peephole, live, "mov rcx, QWORD [rbp - 8]; mov rdi, rcx; add rdi, rcx"));
+    CHECK(peephole.applied(PeepholeRule::copy_prop) == 1);
+
+    // disabled
+    PeepholeOptions options;
+    options.enabled[static_cast<size_t>(PeepholeRule::copy_prop)] = false;
+    PeepholeOptimizer disabled(options);
+    CHECK(rewrites(disabled, copy, "mov rcx, QWORD [rbp - 8]; mov rdi, rcx"));
+    CHECK(disabled.applied(PeepholeRule::copy_prop) == 0);
+}
+
+static void test_imm_operand()
+{
+    PeepholeOptimizer peephole(only(PeepholeRule::imm_operand));
+    CHECK(rewrites(peephole,
+                   {
+                       { .op = Op::mov, .dst = Operand::r(Reg::rdi), .src = Operand::mem(Reg::rbp, -8) },
+                       { .op = Op::mov, .dst = Operand::r(Reg::rcx), .src = Operand::imm(5) },
+                       { .op = Op::sub, .dst = Operand::r(Reg::rdi), .src = Operand::r(Reg::rcx) },
+                   },
+                   "mov rdi, QWORD [rbp - 8]; sub rdi, 5"));
+    CHECK(peephole.applied(PeepholeRule::imm_operand) == 1);
+    CHECK(peephole.removed(PeepholeRule::imm_operand) == 1);
+
+    // only sign-extended 32-bit immediates fit an `add`
+    CHECK(rewrites(peephole,
+                   {
+                       { .op = Op::mov, .dst = Operand::r(Reg::rcx), .src = Operand::imm(1LL << 40) },
+                       { .op = Op::add, .dst = Operand::r(Reg::rdi), .src = Operand::r(Reg::rcx) },
+                   },
+                   "mov rcx, 1099511627776; add rdi, rcx"));
+    CHECK(peephole.applied(PeepholeRule::imm_operand) == 1);
+}
+
+static void test_dead_mov()
+{
+    PeepholeOptimizer peephole(only(PeepholeRule::dead_mov));
+    CHECK(rewrites(peephole,
+                   {
+                       { .op = Op::mov, .dst = Operand::r(Reg::rcx), .src = Operand::imm(7) },
+                       mov_imm(Reg::rsi, 0),
+                       { .op = Op::mov, .dst = Operand::r(Reg::rdi), .src = Operand::imm(1) },
+                   },
+                   "mov rdi, 1"));
+    CHECK(peephole.applied(PeepholeRule::dead_mov) == 2);
+    CHECK(peephole.removed(PeepholeRule::dead_mov) == 2);
+
+    // rdi is overwritten before anyone reads it; the stack pointer never counts as dead
+    CHECK(rewrites(peephole,
+                   {
+                       { .op = Op::mov, .dst = Operand::r(Reg::rdi), .src = Operand::imm(1) },
+                       { .op = Op::mov, .dst = Operand::r(Reg::rsp), .src = Operand::r(Reg::rbp) },
+                       { .op = Op::mov, .dst = Operand::r(Reg::rdi), .src = Operand::imm(2) },
+                   },
+                   "mov rsp, rbp; mov rdi, 2"));
+    CHECK(peephole.applied(PeepholeRule::dead_mov) == 3);
+}
+
+// Rules feed each other: push-pop leaves a copy that copy-prop folds, which leaves a dead load.
+static void test_chain()
+{
+    PeepholeOptimizer peephole;
+    CHECK(rewrites(peephole,
+                   {
+                       { .op = Op::mov, .dst = Operand::r(Reg::rcx), .src = Operand::imm(4) },
+                       { .op = Op::push, .dst = Operand::r(Reg::rcx) },
+                       { .op = Op::pop, .dst = Operand::r(Reg::rdi) },
+                   },
+                   "mov edi, 4"));
+    CHECK(peephole.applied(PeepholeRule::push_pop) == 1);
+    CHECK(peephole.applied(PeepholeRule::copy_prop) == 1);
+}
+
+static void test_rule_names()
+{
+    for (size_t i = 0; i < static_cast<size_t>(PeepholeRule::count); i++) {
+        const auto rule = static_cast<PeepholeRule>(i);
+        CHECK(peephole_rule_from_name(peephole_rule_name(rule)) == rule);
+    }
+    CHECK(!peephole_rule_from_name("push_pop").has_value());
+    CHECK(!peephole_rule_from_name("").has_value());
+}
+
+int main()
+{
+    test_push_pop();
+    test_push_pop_around();
+    test_copy_prop();
+    test_imm_operand();
+    test_dead_mov();
+    test_chain();
+    test_rule_names();
+    return checks_done();
+}
@@ -0,0 +1,55 @@
+// CompileSession outputs: `compile` returns them in memory, `compile_to_file` streams the executable and the listing
+// to files and returns neither.
+
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "check.hpp"
+#include "io.hpp"
+
+static std::string read_file(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::ostringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+int main()
+{
+    const std::string source = "let x = 7;\nlet y = x * 3 + 1;\nexit(y);\n";
+    const std::filesystem::path dir = std::filesystem::temp_directory_path()
+        / ("io_session_test_" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    const std::string path = (dir / "prog").string();
+
+    CompileOptions options;
+    options.emit_assembly = true;
+    const CompileSession session(options);
+    const CompileResult in_memory = session.compile(source);
+    CHECK(in_memory.ok());
+    CHECK(!in_memory.assembly.empty());
+    CHECK(!in_memory.object.empty());
+
+    const CompileResult to_file = session.compile_to_file(source, path);
+    CHECK(to_file.ok());
+    CHECK(to_file.assembly.empty());
+    CHECK(to_file.object.empty());
+    CHECK(read_file(path + ".asm") == in_memory.assembly);
+    CHECK(read_file(path) == std::string(in_memory.object.begin(), in_memory.object.end()));
+
+    // JIT code has no file to go to, the listing still does
+    options.target = CodegenTarget::jit;
+    std::filesystem::remove(path + ".asm");
+    const CompileResult jit = CompileSession(options).compile_to_file(source, path);
+    CHECK(jit.ok());
+    CHECK(!jit.object.empty());
+    CHECK(std::filesystem::exists(path + ".asm"));
+
+    std::filesystem::remove_all(dir);
+    return checks_done();
+}
@@ -0,0 +1,107 @@
+// SymbolTable: ids are dense and in order of first appearance, equal names share one, and names that differ only
+// past the first eight bytes (or only in length) don't, through growth, clear and moves.
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "symbols.hpp"
+
+// `name<i>` padded with a shared prefix to `width` bytes
+static std::string padded(const char* prefix, size_t i, size_t width)
+{
+    char digits[16];
+    std::snprintf(digits, sizeof(digits), "%zu", i);
+    std::string name = prefix;
+    name.resize(width - std::string(digits).size(), 'x');
+    return name + digits;
+}
+
+// every name gets the next id on first sight, the same one after, and reads back unchanged
+static bool interns(SymbolTable& symbols, const std::vector<std::string>& names)
+{
+    const size_t base = symbols.size();
+    bool ok = true;
+    for (size_t i = 0; i < names.size(); i++) {
+        ok = ok && symbols.intern(names[i]) == base + i;
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+        ok = ok && symbols.intern(names[i]) == base + i && symbols.name(static_cast<SymbolId>(base + i)) == names[i];
+    }
+    return ok && symbols.size() == base + names.size();
+}
+
+static void test_first_appearance()
+{
+    SymbolTable symbols;
+    CHECK(symbols.intern("x") == 0);
+    CHECK(symbols.intern("let") == 1);
+    CHECK(symbols.intern("x") == 0);
+    CHECK(symbols.intern("y") == 2);
+    CHECK(symbols.intern(std::string("let")) == 1); // by content, not by pointer
+    CHECK(symbols.size() == 3);
+    CHECK(symbols.name(2) == "y");
+}
+
+// Same first eight bytes, or the same bytes and a different length: the head and the length byte of the hash
+// can't tell these apart alone.
+static void test_shared_prefixes()
+{
+    SymbolTable symbols;
+    const std::string long_name(300, 'a');
+    CHECK(interns(symbols,
+                  {
+                      "abcdefg", "abcdefgh", "abcdefghi", "abcdefghj", "abcdefgh1", "abcdefghabcdefgh",
+                      "abcdefghabcdefghi", "abcdefghabcdefgi", long_name.substr(0, 254), long_name.substr(0, 255),
+                      long_name.substr(0, 256), long_name, long_name.substr(0, 299) + "b", "a", "aa",
+                  }));
+}
+
+// Thousands of names with one head and one length: many share an index slot and some their whole hash, so lookups
+// probe and compare the full names.
+static void test_growth_and_collisions()
+{
+    SymbolTable symbols;
+    std::vector<std::string> names;
+    for (size_t i = 0; i < 20000; i++) {
+        names.push_back(padded("counter", i, 16));
+    }
+    for (size_t i = 0; i < 20000; i++) {
+        std::string name(1 + i % 40, 'x');
+        name[0] = 'v';
+        names.push_back(name + std::to_string(i));
+    }
+    CHECK(interns(symbols, names));
+}
+
+static void test_clear_and_move()
+{
+    SymbolTable symbols;
+    std::vector<std::string> names;
+    for (size_t i = 0; i < 1000; i++) {
+        names.push_back(padded("name", i, 12 + i % 20));
+    }
+    CHECK(interns(symbols, names));
+    symbols.clear();
+    CHECK(symbols.size() == 0);
+    std::vector<std::string> other(names.rbegin(), names.rend());
+    CHECK(interns(symbols, other));
+
+    SymbolTable moved(std::move(symbols));
+    CHECK(moved.size() == other.size() && moved.name(0) == other[0]);
+    CHECK(interns(moved, { "fresh" }));
+    SymbolTable assigned;
+    assigned = std::move(moved);
+    CHECK(assigned.intern(other[999]) == 999 && assigned.name(999) == other[999]);
+}
+
+int main()
+{
+    test_first_appearance();
+    test_shared_prefixes();
+    test_growth_and_collisions();
+    test_clear_and_move();
+    return checks_done();
+}
@@ -0,0 +1,100 @@
+// ThreadPool: work submitted from outside the pool starts in submission order (what `-j` relies on to start the
+// largest units first), nested submits all run, and `parallel_for` rethrows the lowest index's error.
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "thread_pool.hpp"
+
+// A batch of units of mixed sizes, submitted largest first like `compile_batch` does; the order they started in.
+static std::vector<size_t> run_batch(size_t workers, const std::vector<size_t>& sizes_largest_first)
+{
+    std::mutex mutex;
+    std::vector<size_t> started;
+    ThreadPool pool(workers);
+    for (size_t i = 0; i < sizes_largest_first.size(); i++) {
+        pool.submit([&, i] {
+            {
+                std::lock_guard lock(mutex);
+                started.push_back(i);
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(sizes_largest_first[i]));
+        });
+    }
+    pool.wait();
+    return started;
+}
+
+static void test_submission_order()
+{
+    const std::vector<size_t> sizes = { 5000, 2000, 900, 400, 300, 100, 50, 20, 10, 5, 1, 1 };
+
+    // only the caller runs tasks: exactly the submission order
+    const std::vector<size_t> serial = run_batch(0, sizes);
+    CHECK(serial.size() == sizes.size());
+    for (size_t i = 0; i < serial.size(); i++) {
+        CHECK(serial[i] == i);
+    }
+
+    // with workers the threads race for the head of the queue, but the largest unit is among the first to start
+    const size_t workers = 3;
+    const std::vector<size_t> parallel = run_batch(workers, sizes);
+    CHECK(parallel.size() == sizes.size());
+    bool largest_early = false;
+    for (size_t i = 0; i <= workers && i < parallel.size(); i++) {
+        largest_early = largest_early || parallel[i] == 0;
+    }
+    CHECK(largest_early);
+}
+
+static void test_nested_submit()
+{
+    std::atomic<size_t> ran = 0;
+    {
+        ThreadPool pool(2);
+        for (size_t i = 0; i < 16; i++) {
+            pool.submit([&] {
+                ran++;
+                for (size_t k = 0; k < 4; k++) {
+                    pool.submit([&] { ran++; });
+                }
+            });
+        }
+        pool.wait();
+        CHECK(ran == 16 * 5);
+    }
+    CHECK(ran == 16 * 5);
+}
+
+static void test_parallel_for_error()
+{
+    ThreadPool pool(2);
+    std::atomic<size_t> ran = 0;
+    try {
+        pool.parallel_for(32, [&](size_t i) {
+            ran++;
+            if (i == 7 || i == 20) {
+                throw std::runtime_error(std::to_string(i));
+            }
+        });
+        CHECK(false);
+    }
+    catch (const std::runtime_error& error) {
+        CHECK(std::string(error.what()) == "7");
+    }
+    CHECK(ran == 32);
+}
+
+int main()
+{
+    test_submission_order();
+    test_nested_submit();
+    test_parallel_for_error();
+    return checks_done();
+}